@@ -0,0 +1,441 @@
+/*
+ * libevdev stand-in backed by an evemu recording.
+ *
+ * fake_evdev_load() parses the device description (N:, I:, P:, B:, A:
+ * lines) and the event stream (E: lines) of an evemu-record file. The
+ * libevdev calls made by eventcomm.c answer capability queries from that
+ * description, events are read from whatever fd the device was set up
+ * with, so the replay tool controls delivery by writing into a pipe.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <libevdev/libevdev.h>
+
+#include <xorg-server.h>
+#include "fake-symbols.h"
+
+#define NBYTES(x) (((x) + 7) / 8)
+
+static struct {
+    char name[256];
+    int bustype, vendor, product, version;
+    unsigned char props[NBYTES(INPUT_PROP_CNT)];
+    unsigned char bits[EV_CNT][NBYTES(KEY_CNT)];
+    struct input_absinfo abs[ABS_CNT];
+
+    struct input_event *events;
+    size_t nevents;
+} desc;
+
+struct libevdev {
+    int fd;
+};
+
+static int
+test_bit(const unsigned char *bits, unsigned int bit)
+{
+    return (bits[bit / 8] >> (bit % 8)) & 1;
+}
+
+static void
+set_bit(unsigned char *bits, unsigned int bit)
+{
+    bits[bit / 8] |= 1 << (bit % 8);
+}
+
+static void
+set_abs(unsigned int code, int minimum, int maximum, int resolution)
+{
+    set_bit(desc.bits[EV_ABS], code);
+    desc.abs[code].minimum = minimum;
+    desc.abs[code].maximum = maximum;
+    desc.abs[code].resolution = resolution;
+}
+
+/* Parse a list of hex bytes into bits starting at byte offset *off */
+static void
+parse_bytes(const char *str, unsigned char *bits, size_t size, size_t *off)
+{
+    char *end;
+    unsigned long byte;
+
+    for (;;) {
+        byte = strtoul(str, &end, 16);
+        if (end == str)
+            break;
+        if (*off < size)
+            bits[*off] = byte;
+        (*off)++;
+        str = end;
+    }
+}
+
+Bool
+fake_evdev_load(const char *path)
+{
+    FILE *f;
+    char line[1024];
+    size_t prop_off = 0, bit_off[EV_CNT] = { 0 };
+    size_t allocated = 0;
+
+    f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return FALSE;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        const char *data = line + 2;
+
+        if (line[0] == '\0' || line[1] != ':')
+            continue;
+
+        switch (line[0]) {
+        case 'N':
+            while (*data == ' ')
+                data++;
+            snprintf(desc.name, sizeof(desc.name), "%s", data);
+            desc.name[strcspn(desc.name, "\n")] = '\0';
+            break;
+        case 'I':
+            sscanf(data, "%x %x %x %x", &desc.bustype, &desc.vendor,
+                   &desc.product, &desc.version);
+            break;
+        case 'P':
+            parse_bytes(data, desc.props, sizeof(desc.props), &prop_off);
+            break;
+        case 'B':
+        {
+            char *end;
+            unsigned long type = strtoul(data, &end, 16);
+
+            if (end != data && type < EV_CNT)
+                parse_bytes(end, desc.bits[type], sizeof(desc.bits[type]),
+                            &bit_off[type]);
+            break;
+        }
+        case 'A':
+        {
+            unsigned int code;
+            struct input_absinfo abs = { 0 };
+
+            if (sscanf(data, "%x %d %d %d %d %d", &code, &abs.minimum,
+                       &abs.maximum, &abs.fuzz, &abs.flat,
+                       &abs.resolution) >= 5 && code < ABS_CNT)
+                desc.abs[code] = abs;
+            break;
+        }
+        case 'E':
+        {
+            long sec, usec;
+            unsigned int type, code;
+            int value;
+            struct input_event *ev;
+
+            if (sscanf(data, "%ld.%ld %x %x %d", &sec, &usec, &type, &code,
+                       &value) != 5)
+                break;
+
+            if (desc.nevents == allocated) {
+                allocated = allocated ? allocated * 2 : 1024;
+                ev = realloc(desc.events, allocated * sizeof(*ev));
+                if (!ev) {
+                    fclose(f);
+                    return FALSE;
+                }
+                desc.events = ev;
+            }
+
+            ev = &desc.events[desc.nevents++];
+            ev->time.tv_sec = sec;
+            ev->time.tv_usec = usec;
+            ev->type = type;
+            ev->code = code;
+            ev->value = value;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    fclose(f);
+
+    if (!test_bit(desc.bits[0], EV_ABS)) {
+        fprintf(stderr, "%s: not an evemu recording of an absolute device\n",
+                path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+fake_evdev_load_clickpad(void)
+{
+    static const unsigned int keys[] = {
+        BTN_LEFT, BTN_TOUCH, BTN_TOOL_FINGER, BTN_TOOL_DOUBLETAP,
+        BTN_TOOL_TRIPLETAP, BTN_TOOL_QUADTAP, BTN_TOOL_QUINTTAP,
+    };
+    unsigned int i;
+
+    memset(&desc, 0, sizeof(desc));
+    snprintf(desc.name, sizeof(desc.name), "Synthetic Clickpad");
+    desc.bustype = BUS_I8042;
+    desc.vendor = 0x2;
+    desc.product = 0x7;
+
+    set_bit(desc.props, INPUT_PROP_POINTER);
+    set_bit(desc.props, INPUT_PROP_BUTTONPAD);
+
+    set_bit(desc.bits[0], EV_SYN);
+    set_bit(desc.bits[0], EV_KEY);
+    set_bit(desc.bits[0], EV_ABS);
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+        set_bit(desc.bits[EV_KEY], keys[i]);
+
+    set_abs(ABS_X, FAKE_CLICKPAD_MIN_X, FAKE_CLICKPAD_MAX_X, 44);
+    set_abs(ABS_Y, FAKE_CLICKPAD_MIN_Y, FAKE_CLICKPAD_MAX_Y, 65);
+    set_abs(ABS_PRESSURE, 0, 255, 0);
+    set_abs(ABS_TOOL_WIDTH, 0, 15, 0);
+    set_abs(ABS_MT_SLOT, 0, FAKE_CLICKPAD_SLOTS - 1, 0);
+    set_abs(ABS_MT_POSITION_X, FAKE_CLICKPAD_MIN_X, FAKE_CLICKPAD_MAX_X, 44);
+    set_abs(ABS_MT_POSITION_Y, FAKE_CLICKPAD_MIN_Y, FAKE_CLICKPAD_MAX_Y, 65);
+    set_abs(ABS_MT_TRACKING_ID, 0, 65535, 0);
+    set_abs(ABS_MT_PRESSURE, 0, 255, 0);
+}
+
+const struct input_event *
+fake_evdev_events(size_t *nevents)
+{
+    *nevents = desc.nevents;
+    return desc.events;
+}
+
+struct libevdev *
+libevdev_new(void)
+{
+    struct libevdev *dev = calloc(1, sizeof(*dev));
+
+    if (dev)
+        dev->fd = -1;
+
+    return dev;
+}
+
+int
+libevdev_new_from_fd(int fd, struct libevdev **dev)
+{
+    *dev = libevdev_new();
+    if (!*dev)
+        return -ENOMEM;
+
+    return libevdev_set_fd(*dev, fd);
+}
+
+void
+libevdev_free(struct libevdev *dev)
+{
+    free(dev);
+}
+
+int
+libevdev_set_fd(struct libevdev *dev, int fd)
+{
+    if (dev->fd != -1)
+        return -EBADF;
+
+    dev->fd = fd;
+    return 0;
+}
+
+int
+libevdev_change_fd(struct libevdev *dev, int fd)
+{
+    dev->fd = fd;
+    return 0;
+}
+
+int
+libevdev_get_fd(const struct libevdev *dev)
+{
+    return dev->fd;
+}
+
+int
+libevdev_next_event(struct libevdev *dev, unsigned int flags,
+                    struct input_event *ev)
+{
+    ssize_t len;
+
+    /* a pipe never drops events, so a forced sync has nothing to report */
+    if (flags & LIBEVDEV_READ_FLAG_FORCE_SYNC) {
+        memset(ev, 0, sizeof(*ev));
+        ev->type = EV_SYN;
+        ev->code = SYN_DROPPED;
+        return LIBEVDEV_READ_STATUS_SYNC;
+    }
+    if (flags & LIBEVDEV_READ_FLAG_SYNC)
+        return -EAGAIN;
+
+    len = read(dev->fd, ev, sizeof(*ev));
+    if (len < 0)
+        return -errno;
+    if (len != sizeof(*ev))
+        return -EAGAIN;
+
+    return LIBEVDEV_READ_STATUS_SUCCESS;
+}
+
+int
+libevdev_grab(struct libevdev *dev, enum libevdev_grab_mode grab)
+{
+    return 0;
+}
+
+int
+libevdev_set_clock_id(struct libevdev *dev, int clockid)
+{
+    return 0;
+}
+
+int
+libevdev_has_event_type(const struct libevdev *dev, unsigned int type)
+{
+    return type < EV_CNT && test_bit(desc.bits[0], type);
+}
+
+int
+libevdev_has_event_code(const struct libevdev *dev, unsigned int type,
+                        unsigned int code)
+{
+    return libevdev_has_event_type(dev, type) && code < KEY_CNT &&
+        test_bit(desc.bits[type], code);
+}
+
+int
+libevdev_has_property(const struct libevdev *dev, unsigned int prop)
+{
+    return prop < INPUT_PROP_CNT && test_bit(desc.props, prop);
+}
+
+const struct input_absinfo *
+libevdev_get_abs_info(const struct libevdev *dev, unsigned int code)
+{
+    if (!libevdev_has_event_code(dev, EV_ABS, code))
+        return NULL;
+
+    return &desc.abs[code];
+}
+
+int
+libevdev_get_abs_minimum(const struct libevdev *dev, unsigned int code)
+{
+    const struct input_absinfo *abs = libevdev_get_abs_info(dev, code);
+
+    return abs ? abs->minimum : 0;
+}
+
+int
+libevdev_get_abs_maximum(const struct libevdev *dev, unsigned int code)
+{
+    const struct input_absinfo *abs = libevdev_get_abs_info(dev, code);
+
+    return abs ? abs->maximum : 0;
+}
+
+int
+libevdev_get_abs_resolution(const struct libevdev *dev, unsigned int code)
+{
+    const struct input_absinfo *abs = libevdev_get_abs_info(dev, code);
+
+    return abs ? abs->resolution : 0;
+}
+
+int
+libevdev_get_num_slots(const struct libevdev *dev)
+{
+    const struct input_absinfo *abs = libevdev_get_abs_info(dev, ABS_MT_SLOT);
+
+    return abs ? abs->maximum + 1 : -1;
+}
+
+int
+libevdev_get_current_slot(const struct libevdev *dev)
+{
+    /* recordings start with no touches down, i.e. in slot 0 */
+    return 0;
+}
+
+int
+libevdev_get_slot_value(const struct libevdev *dev, unsigned int slot,
+                        unsigned int code)
+{
+    return code == ABS_MT_TRACKING_ID ? -1 : 0;
+}
+
+int
+libevdev_get_event_value(const struct libevdev *dev, unsigned int type,
+                         unsigned int code)
+{
+    return 0;
+}
+
+int
+libevdev_set_event_value(struct libevdev *dev, unsigned int type,
+                         unsigned int code, int value)
+{
+    return libevdev_has_event_code(dev, type, code) ? 0 : -1;
+}
+
+int
+libevdev_set_slot_value(struct libevdev *dev, unsigned int slot,
+                        unsigned int code, int value)
+{
+    return libevdev_has_event_code(dev, EV_ABS, code) ? 0 : -1;
+}
+
+int
+libevdev_get_id_vendor(const struct libevdev *dev)
+{
+    return desc.vendor;
+}
+
+int
+libevdev_get_id_product(const struct libevdev *dev)
+{
+    return desc.product;
+}
+
+const char *
+libevdev_get_name(const struct libevdev *dev)
+{
+    return desc.name;
+}
+
+void
+libevdev_set_log_function(libevdev_log_func_t logfunc, void *data)
+{
+}
+
+void
+libevdev_set_log_priority(enum libevdev_log_priority priority)
+{
+}
+
+void
+libevdev_set_device_log_function(struct libevdev *dev,
+                                 libevdev_device_log_func_t logfunc,
+                                 enum libevdev_log_priority priority,
+                                 void *data)
+{
+}
@@ -0,0 +1,908 @@
+/*
+ * Stub X server layer for running the driver outside of the X server.
+ *
+ * Only as much of the server is implemented as the driver needs to run its
+ * DEVICE_INIT/DEVICE_ON path, read events and post them. Time is virtual:
+ * GetTimeInMillis() returns fake_time, which the replay tool advances to
+ * the timestamps of the recording, and the single driver timer is only run
+ * from fake_timer_run_until().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <xorg-server.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <misc.h>
+#include <xf86.h>
+#include <xf86_OSproc.h>
+#include <xf86Xinput.h>
+#include <exevents.h>
+#include <ptrveloc.h>
+#include <xisb.h>
+
+#include "synapticsstr.h"
+#include "fake-symbols.h"
+
+CARD32 fake_time;
+int fake_verbosity = -1;
+int fake_serial_fd = -1;
+void (*fake_event_hook) (const struct fake_event * ev);
+unsigned long fake_timer_fires;
+
+/******************************************************************************
+ * Timers
+ *****************************************************************************/
+
+struct _OsTimerRec {
+    CARD32 expires;
+    OsTimerCallback callback;
+    void *arg;
+    Bool armed;
+};
+
+/* The driver only ever uses one timer per device */
+static OsTimerPtr fake_timer;
+
+OsTimerPtr
+TimerSet(OsTimerPtr timer, int flags, CARD32 millis,
+         OsTimerCallback func, void *arg)
+{
+    if (!timer) {
+        timer = calloc(1, sizeof(*timer));
+        if (!timer)
+            return NULL;
+    }
+
+    timer->armed = FALSE;
+    timer->callback = func;
+    timer->arg = arg;
+    if (!millis)
+        return timer;
+
+    timer->expires = (flags & TimerAbsolute) ? millis : fake_time + millis;
+    timer->armed = TRUE;
+    fake_timer = timer;
+
+    return timer;
+}
+
+void
+TimerCancel(OsTimerPtr timer)
+{
+    if (timer)
+        timer->armed = FALSE;
+}
+
+void
+TimerFree(OsTimerPtr timer)
+{
+    if (timer == fake_timer)
+        fake_timer = NULL;
+    free(timer);
+}
+
+CARD32
+GetTimeInMillis(void)
+{
+    return fake_time;
+}
+
+Bool
+fake_timer_expiry(CARD32 *millis)
+{
+    if (!fake_timer || !fake_timer->armed)
+        return FALSE;
+
+    *millis = fake_timer->expires;
+    return TRUE;
+}
+
+int
+fake_timer_run_until(CARD32 millis)
+{
+    int count = 0;
+
+    while (fake_timer && fake_timer->armed &&
+           (int) (millis - fake_timer->expires) >= 0) {
+        OsTimerPtr timer = fake_timer;
+        CARD32 next;
+
+        fake_time = timer->expires;
+        timer->armed = FALSE;
+        fake_timer_fires++;
+        count++;
+
+        next = timer->callback(timer, fake_time, timer->arg);
+        if (next)
+            TimerSet(timer, 0, next, timer->callback, timer->arg);
+    }
+
+    if ((int) (millis - fake_time) > 0)
+        fake_time = millis;
+
+    return count;
+}
+
+#if HAVE_THREADED_INPUT
+void
+input_lock(void)
+{
+}
+
+void
+input_unlock(void)
+{
+}
+#else
+int
+xf86BlockSIGIO(void)
+{
+    return 0;
+}
+
+void
+xf86UnblockSIGIO(int wasset)
+{
+}
+#endif
+
+/******************************************************************************
+ * Logging
+ *****************************************************************************/
+
+static void
+fake_vlog(int verb, const char *format, va_list args)
+{
+    if (verb > fake_verbosity)
+        return;
+
+    vfprintf(stderr, format, args);
+}
+
+int
+xf86GetVerbosity(void)
+{
+    return fake_verbosity;
+}
+
+/* There is no log file, messages go to stderr only */
+int
+xf86GetLogVerbosity(void)
+{
+    return fake_verbosity;
+}
+
+void
+ErrorF(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fake_vlog(0, format, args);
+    va_end(args);
+}
+
+void
+xf86Msg(MessageType type, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fake_vlog(1, format, args);
+    va_end(args);
+}
+
+void
+xf86MsgVerb(MessageType type, int verb, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fake_vlog(verb, format, args);
+    va_end(args);
+}
+
+void
+xf86ErrorFVerb(int verb, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fake_vlog(verb, format, args);
+    va_end(args);
+}
+
+void
+xf86IDrvMsg(InputInfoPtr dev, MessageType type, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fake_vlog(type == X_ERROR ? 0 : 1, format, args);
+    va_end(args);
+}
+
+void
+xf86IDrvMsgVerb(InputInfoPtr dev, MessageType type, int verb,
+                const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fake_vlog(verb, format, args);
+    va_end(args);
+}
+
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 18
+void
+LogMessageVerbSigSafe(MessageType type, int verb, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fake_vlog(verb, format, args);
+    va_end(args);
+}
+
+void
+LogVMessageVerbSigSafe(MessageType type, int verb, const char *format,
+                       va_list args)
+{
+    fake_vlog(verb, format, args);
+}
+#endif
+
+/******************************************************************************
+ * Options
+ *
+ * There is only one device, so a single global option table stands in for
+ * the server's option lists and the list pointers are ignored.
+ *****************************************************************************/
+
+#define FAKE_MAX_OPTIONS 64
+
+static struct {
+    char *name;
+    char *value;
+} fake_options[FAKE_MAX_OPTIONS];
+
+void
+fake_option_set(const char *name, const char *value)
+{
+    int i;
+
+    for (i = 0; i < FAKE_MAX_OPTIONS && fake_options[i].name; i++) {
+        if (strcasecmp(fake_options[i].name, name) == 0)
+            break;
+    }
+    if (i == FAKE_MAX_OPTIONS)
+        return;
+
+    if (!fake_options[i].name)
+        fake_options[i].name = strdup(name);
+    free(fake_options[i].value);
+    fake_options[i].value = strdup(value);
+}
+
+char *
+xf86FindOptionValue(XF86OptionPtr options, const char *name)
+{
+    int i;
+
+    for (i = 0; i < FAKE_MAX_OPTIONS && fake_options[i].name; i++) {
+        if (strcasecmp(fake_options[i].name, name) == 0)
+            return fake_options[i].value;
+    }
+
+    return NULL;
+}
+
+XF86OptionPtr
+xf86ReplaceStrOption(XF86OptionPtr optlist, const char *name,
+                     const char *val)
+{
+    fake_option_set(name, val);
+    return optlist;
+}
+
+char *
+xf86SetStrOption(XF86OptionPtr optlist, const char *name, const char *deflt)
+{
+    char *value = xf86FindOptionValue(optlist, name);
+
+    if (!value)
+        value = (char *) deflt;
+
+    return value ? strdup(value) : NULL;
+}
+
+char *
+xf86CheckStrOption(XF86OptionPtr optlist, const char *name,
+                   const char *deflt)
+{
+    return xf86SetStrOption(optlist, name, deflt);
+}
+
+int
+xf86SetIntOption(XF86OptionPtr optlist, const char *name, int deflt)
+{
+    char *value = xf86FindOptionValue(optlist, name);
+
+    return value ? strtol(value, NULL, 0) : deflt;
+}
+
+double
+xf86SetRealOption(XF86OptionPtr optlist, const char *name, double deflt)
+{
+    char *value = xf86FindOptionValue(optlist, name);
+
+    return value ? strtod(value, NULL) : deflt;
+}
+
+int
+xf86SetBoolOption(XF86OptionPtr list, const char *name, int deflt)
+{
+    char *value = xf86FindOptionValue(list, name);
+
+    if (!value)
+        return deflt;
+
+    return strcasecmp(value, "on") == 0 || strcasecmp(value, "true") == 0 ||
+        strcasecmp(value, "yes") == 0 || strcmp(value, "1") == 0;
+}
+
+double
+xf86CheckPercentOption(XF86OptionPtr list, const char *name, double deflt)
+{
+    char *value = xf86FindOptionValue(list, name);
+    char *end;
+    double percent;
+
+    if (!value)
+        return deflt;
+
+    percent = strtod(value, &end);
+    return (end != value && *end == '%') ? percent : deflt;
+}
+
+double
+xf86SetPercentOption(XF86OptionPtr list, const char *name, double deflt)
+{
+    return xf86CheckPercentOption(list, name, deflt);
+}
+
+/******************************************************************************
+ * Device setup
+ *****************************************************************************/
+
+int
+xf86OpenSerial(XF86OptionPtr options)
+{
+    return fake_serial_fd;
+}
+
+int
+xf86CloseSerial(int fd)
+{
+    /* the replay tool owns the fd */
+    return 0;
+}
+
+int
+xf86FlushInput(int fd)
+{
+    return 0;
+}
+
+int
+xf86ReadSerial(int fd, void *buf, int count)
+{
+    return read(fd, buf, count);
+}
+
+int
+xf86WriteSerial(int fd, const void *buf, int count)
+{
+    return write(fd, buf, count);
+}
+
+int
+xf86WaitForInput(int fd, int timeout)
+{
+    return 0;
+}
+
+XISBuffer *
+XisbNew(int fd, ssize_t size)
+{
+    return calloc(1, sizeof(XISBuffer));
+}
+
+void
+XisbFree(XISBuffer * b)
+{
+    free(b);
+}
+
+int
+XisbRead(XISBuffer * b)
+{
+    return -1;
+}
+
+void
+XisbBlockDuration(XISBuffer * b, int msec)
+{
+}
+
+void
+xf86AddEnabledDevice(InputInfoPtr pInfo)
+{
+}
+
+void
+xf86RemoveEnabledDevice(InputInfoPtr pInfo)
+{
+}
+
+void
+xf86DeleteInput(InputInfoPtr pInp, int flags)
+{
+}
+
+void
+xf86AddInputDriver(InputDriverPtr driver, void *module, int flags)
+{
+}
+
+void
+xf86ProcessCommonOptions(InputInfoPtr pInfo, XF86OptionPtr options)
+{
+}
+
+Bool
+InitPointerDeviceStruct(DevicePtr device, CARD8 *map, int numButtons,
+                        Atom *btn_labels, PtrCtrlProcPtr controlProc,
+                        int numMotionEvents, int numAxes, Atom *axes_labels)
+{
+    return TRUE;
+}
+
+int
+GetMotionHistorySize(void)
+{
+    return 0;
+}
+
+Bool
+xf86InitValuatorAxisStruct(DeviceIntPtr dev, int axnum, Atom label,
+                           int minval, int maxval, int resolution,
+                           int min_res, int max_res, int mode)
+{
+    return TRUE;
+}
+
+void
+xf86InitValuatorDefaults(DeviceIntPtr dev, int axnum)
+{
+}
+
+/* axis numbers of the scroll valuators, -1 if unset */
+static int fake_scroll_axis_horiz = -1;
+static int fake_scroll_axis_vert = -1;
+
+Bool
+SetScrollValuator(DeviceIntPtr dev, int axnum, enum ScrollType type,
+                  double increment, int flags)
+{
+    if (type == SCROLL_TYPE_HORIZONTAL)
+        fake_scroll_axis_horiz = axnum;
+    else if (type == SCROLL_TYPE_VERTICAL)
+        fake_scroll_axis_vert = axnum;
+
+    return TRUE;
+}
+
+DeviceVelocityPtr
+GetDevicePredictableAccelData(DeviceIntPtr dev)
+{
+    /* no pointer acceleration, the replay tools look at driver deltas */
+    return NULL;
+}
+
+void
+SetDeviceSpecificAccelerationProfile(DeviceVelocityPtr vel,
+                                     PointerAccelerationProfileFunc profile)
+{
+}
+
+/******************************************************************************
+ * Atoms and properties
+ *****************************************************************************/
+
+#define FAKE_MAX_ATOMS 512
+
+static char *fake_atoms[FAKE_MAX_ATOMS];
+static int fake_num_atoms;
+
+/* Property values by atom, and the driver's handlers. Like the server,
+ * changes are checked with the set handler before they are stored. */
+static XIPropertyValueRec fake_props[FAKE_MAX_ATOMS];
+static int (*fake_set_property) (DeviceIntPtr dev, Atom property,
+                                 XIPropertyValuePtr prop, BOOL checkonly);
+static int (*fake_get_property) (DeviceIntPtr dev, Atom property);
+
+Atom
+MakeAtom(const char *string, unsigned len, Bool makeit)
+{
+    int i;
+
+    for (i = 0; i < fake_num_atoms; i++) {
+        if (strlen(fake_atoms[i]) == len &&
+            strncmp(fake_atoms[i], string, len) == 0)
+            return i + 1;
+    }
+
+    if (!makeit || fake_num_atoms == FAKE_MAX_ATOMS)
+        return None;
+
+    fake_atoms[fake_num_atoms] = strndup(string, len);
+    return ++fake_num_atoms;
+}
+
+const char *
+NameForAtom(Atom atom)
+{
+    if (atom == None || atom > fake_num_atoms)
+        return NULL;
+
+    return fake_atoms[atom - 1];
+}
+
+Atom
+XIGetKnownProperty(const char *name)
+{
+    return MakeAtom(name, strlen(name), TRUE);
+}
+
+int
+XIChangeDeviceProperty(DeviceIntPtr dev, Atom property, Atom type,
+                       int format, int mode, unsigned long len,
+                       const void *value, Bool sendevent)
+{
+    XIPropertyValuePtr prop;
+    XIPropertyValueRec new_value;
+    void *data;
+    int rc;
+
+    if (property == None || property > fake_num_atoms)
+        return BadAtom;
+    if (mode != PropModeReplace)
+        return BadImplementation;
+
+    new_value.type = type;
+    new_value.format = format;
+    new_value.size = len;
+    new_value.data = (pointer) value;
+
+    if (fake_set_property) {
+        rc = fake_set_property(dev, property, &new_value, TRUE);
+        if (rc == Success)
+            rc = fake_set_property(dev, property, &new_value, FALSE);
+        if (rc != Success)
+            return rc;
+    }
+
+    data = malloc(len * format / 8 + 1);
+    if (!data)
+        return BadAlloc;
+    memcpy(data, value, len * format / 8);
+
+    prop = &fake_props[property - 1];
+    free(prop->data);
+    *prop = new_value;
+    prop->data = data;
+
+    return Success;
+}
+
+int
+fake_property_get(DeviceIntPtr dev, const char *name, int *values,
+                  int nvalues)
+{
+    Atom property = MakeAtom(name, strlen(name), FALSE);
+    XIPropertyValuePtr prop;
+    int i;
+
+    if (property == None)
+        return -1;
+    if (fake_get_property && fake_get_property(dev, property) != Success)
+        return -1;
+
+    prop = &fake_props[property - 1];
+    for (i = 0; i < prop->size && i < nvalues; i++) {
+        switch (prop->format) {
+        case 8:
+            values[i] = ((CARD8 *) prop->data)[i];
+            break;
+        case 16:
+            values[i] = ((INT16 *) prop->data)[i];
+            break;
+        default:
+            values[i] = ((INT32 *) prop->data)[i];
+            break;
+        }
+    }
+
+    return prop->size;
+}
+
+int
+fake_property_set(DeviceIntPtr dev, const char *name, const int *values,
+                  int nvalues)
+{
+    Atom property = MakeAtom(name, strlen(name), FALSE);
+    XIPropertyValuePtr prop;
+    INT32 data[64];
+    int i;
+
+    if (property == None || nvalues > 64)
+        return BadAtom;
+
+    prop = &fake_props[property - 1];
+    for (i = 0; i < nvalues; i++) {
+        switch (prop->format) {
+        case 8:
+            ((CARD8 *) data)[i] = values[i];
+            break;
+        case 16:
+            ((INT16 *) data)[i] = values[i];
+            break;
+        default:
+            data[i] = values[i];
+            break;
+        }
+    }
+
+    return XIChangeDeviceProperty(dev, property, prop->type, prop->format,
+                                  PropModeReplace, nvalues, data, FALSE);
+}
+
+int
+XIDeleteDeviceProperty(DeviceIntPtr device, Atom property, Bool fromClient)
+{
+    return Success;
+}
+
+int
+XISetDevicePropertyDeletable(DeviceIntPtr dev, Atom property, Bool deletable)
+{
+    return Success;
+}
+
+long
+XIRegisterPropertyHandler(DeviceIntPtr dev,
+                          int (*SetProperty) (DeviceIntPtr dev,
+                                              Atom property,
+                                              XIPropertyValuePtr prop,
+                                              BOOL checkonly),
+                          int (*GetProperty) (DeviceIntPtr dev,
+                                              Atom property),
+                          int (*DeleteProperty) (DeviceIntPtr dev,
+                                                 Atom property))
+{
+    fake_set_property = SetProperty;
+    fake_get_property = GetProperty;
+    return 1;
+}
+
+/******************************************************************************
+ * Valuator masks
+ *****************************************************************************/
+
+ValuatorMask *
+valuator_mask_new(int num_valuators)
+{
+    ValuatorMask *mask = calloc(1, sizeof(ValuatorMask));
+
+    if (mask)
+        mask->last_bit = -1;
+
+    return mask;
+}
+
+void
+valuator_mask_free(ValuatorMask **mask)
+{
+    free(*mask);
+    *mask = NULL;
+}
+
+void
+valuator_mask_zero(ValuatorMask *mask)
+{
+    memset(mask, 0, sizeof(*mask));
+    mask->last_bit = -1;
+}
+
+int
+valuator_mask_isset(const ValuatorMask *mask, int bit)
+{
+    return (mask->mask[bit >> 3] >> (bit & 7)) & 1;
+}
+
+void
+valuator_mask_set_double(ValuatorMask *mask, int valuator, double data)
+{
+    mask->mask[valuator >> 3] |= 1 << (valuator & 7);
+    mask->valuators[valuator] = data;
+    if (valuator > mask->last_bit)
+        mask->last_bit = valuator;
+}
+
+void
+valuator_mask_set(ValuatorMask *mask, int valuator, int data)
+{
+    valuator_mask_set_double(mask, valuator, data);
+}
+
+void
+valuator_mask_set_range(ValuatorMask *mask, int first_valuator,
+                        int num_valuators, const int *valuators)
+{
+    int i;
+
+    for (i = 0; i < num_valuators; i++)
+        valuator_mask_set(mask, first_valuator + i, valuators[i]);
+}
+
+void
+valuator_mask_unset(ValuatorMask *mask, int bit)
+{
+    int i;
+
+    if (bit > mask->last_bit)
+        return;
+
+    mask->mask[bit >> 3] &= ~(1 << (bit & 7));
+    mask->valuators[bit] = 0;
+
+    if (bit < mask->last_bit)
+        return;
+
+    mask->last_bit = -1;
+    for (i = bit - 1; i >= 0; i--) {
+        if (valuator_mask_isset(mask, i)) {
+            mask->last_bit = i;
+            break;
+        }
+    }
+}
+
+int
+valuator_mask_size(const ValuatorMask *mask)
+{
+    return mask->last_bit + 1;
+}
+
+int
+valuator_mask_num_valuators(const ValuatorMask *mask)
+{
+    int i, count = 0;
+
+    for (i = 0; i <= mask->last_bit; i++)
+        count += valuator_mask_isset(mask, i);
+
+    return count;
+}
+
+void
+valuator_mask_copy(ValuatorMask *dest, const ValuatorMask *src)
+{
+    if (src)
+        memcpy(dest, src, sizeof(*dest));
+    else
+        valuator_mask_zero(dest);
+}
+
+double
+valuator_mask_get_double(const ValuatorMask *mask, int valuator)
+{
+    return mask->valuators[valuator];
+}
+
+int
+valuator_mask_get(const ValuatorMask *mask, int valuator)
+{
+    return trunc(valuator_mask_get_double(mask, valuator));
+}
+
+Bool
+valuator_mask_fetch_double(const ValuatorMask *mask, int valuator,
+                           double *value)
+{
+    if (!valuator_mask_isset(mask, valuator))
+        return FALSE;
+
+    *value = valuator_mask_get_double(mask, valuator);
+    return TRUE;
+}
+
+/******************************************************************************
+ * Event posting
+ *****************************************************************************/
+
+static void
+fake_post(const struct fake_event *ev)
+{
+    if (fake_event_hook)
+        fake_event_hook(ev);
+}
+
+void
+xf86PostMotionEventM(DeviceIntPtr device, int is_absolute,
+                     const ValuatorMask *mask)
+{
+    struct fake_event ev = { .millis = fake_time };
+    double h = 0, v = 0;
+
+    if (valuator_mask_isset(mask, 0) || valuator_mask_isset(mask, 1)) {
+        ev.type = FAKE_EV_MOTION;
+        valuator_mask_fetch_double(mask, 0, &ev.dx);
+        valuator_mask_fetch_double(mask, 1, &ev.dy);
+        fake_post(&ev);
+    }
+
+    if (fake_scroll_axis_horiz >= 0)
+        valuator_mask_fetch_double(mask, fake_scroll_axis_horiz, &h);
+    if (fake_scroll_axis_vert >= 0)
+        valuator_mask_fetch_double(mask, fake_scroll_axis_vert, &v);
+    if (h != 0 || v != 0) {
+        ev.type = FAKE_EV_SCROLL;
+        ev.dx = h;
+        ev.dy = v;
+        fake_post(&ev);
+    }
+}
+
+void
+xf86PostMotionEvent(DeviceIntPtr device, int is_absolute,
+                    int first_valuator, int num_valuators, ...)
+{
+    ValuatorMask mask;
+    va_list args;
+    int i;
+
+    valuator_mask_zero(&mask);
+    va_start(args, num_valuators);
+    for (i = 0; i < num_valuators; i++)
+        valuator_mask_set(&mask, first_valuator + i, va_arg(args, int));
+    va_end(args);
+
+    xf86PostMotionEventM(device, is_absolute, &mask);
+}
+
+void
+xf86PostButtonEvent(DeviceIntPtr device, int is_absolute, int button,
+                    int is_down, int first_valuator, int num_valuators, ...)
+{
+    struct fake_event ev = { .millis = fake_time };
+
+    ev.type = FAKE_EV_BUTTON;
+    ev.button = button;
+    ev.is_down = is_down;
+    fake_post(&ev);
+}
+
+void
+xf86PostTouchEvent(DeviceIntPtr dev, uint32_t touchid, uint16_t type,
+                   uint32_t flags, const ValuatorMask *mask)
+{
+    /* clickpads post touch events through the server's touch emulation,
+     * the pointer events the replay tools look at are posted separately */
+}
@@ -0,0 +1,80 @@
+/*
+ * Stub X server layer for running the driver outside of the X server.
+ *
+ * The functions declared in the server SDK headers are implemented in
+ * fake-symbols.c. This header only declares the hooks the replay tools use
+ * to drive the stubs: the virtual clock, the timer and the capture of
+ * posted events.
+ */
+
+#ifndef _FAKE_SYMBOLS_H_
+#define _FAKE_SYMBOLS_H_
+
+#include <xorg-server.h>
+#include <xf86Xinput.h>
+
+enum FakeEventType {
+    FAKE_EV_MOTION,
+    FAKE_EV_BUTTON,
+    FAKE_EV_SCROLL,
+};
+
+/* An event posted by the driver, timestamped with the virtual clock */
+struct fake_event {
+    enum FakeEventType type;
+    CARD32 millis;
+    double dx, dy;              /* motion or scroll deltas */
+    int button;
+    Bool is_down;
+};
+
+/* Virtual server time in ms, returned by GetTimeInMillis() */
+extern CARD32 fake_time;
+
+/* Verbosity threshold for DBG/xf86MsgVerb output, -1 silences everything */
+extern int fake_verbosity;
+
+/* fd returned by xf86OpenSerial() */
+extern int fake_serial_fd;
+
+/* Called for every motion, button and scroll event the driver posts */
+extern void (*fake_event_hook) (const struct fake_event * ev);
+
+/* Number of times the driver's timer has fired */
+extern unsigned long fake_timer_fires;
+
+/* Option handling, stands in for the server's option lists */
+extern void fake_option_set(const char *name, const char *value);
+
+/* Run all timer callbacks due up to and including millis, advancing
+ * fake_time to each expiry. Returns the number of callbacks run. */
+extern int fake_timer_run_until(CARD32 millis);
+
+/* Expiry of the armed timer, FALSE if no timer is armed */
+extern Bool fake_timer_expiry(CARD32 *millis);
+
+/* Read up to nvalues of an integer property through the driver's get
+ * handler. Returns the number of values the property has, -1 if there is
+ * no such property. */
+extern int fake_property_get(DeviceIntPtr dev, const char *name, int *values,
+                             int nvalues);
+
+/* Change an integer property through the driver's set handler, in the
+ * property's own type and format. Returns the handler's status. */
+extern int fake_property_set(DeviceIntPtr dev, const char *name,
+                             const int *values, int nvalues);
+
+/* Recording support, implemented in fake-evdev.c */
+struct input_event;
+extern Bool fake_evdev_load(const char *path);
+
+/* Use a built-in description of a 5-slot clickpad instead of a recording */
+#define FAKE_CLICKPAD_MIN_X 1266
+#define FAKE_CLICKPAD_MAX_X 5676
+#define FAKE_CLICKPAD_MIN_Y 1096
+#define FAKE_CLICKPAD_MAX_Y 4758
+#define FAKE_CLICKPAD_SLOTS 5
+extern void fake_evdev_load_clickpad(void);
+extern const struct input_event *fake_evdev_events(size_t *nevents);
+
+#endif                          /* _FAKE_SYMBOLS_H_ */
@@ -0,0 +1,597 @@
+/*
+ * synbench - time the stages of HandleState on synthetic input.
+ *
+ * This file includes synaptics.c so it can define the STAGE_BEGIN and
+ * STAGE_END hooks around the stages the driver keeps latency histograms
+ * of, from ReadInput down to posting the events. The driver's own timing
+ * still runs inside them, so its cost is part of the numbers. Synthetic
+ * one-, two- and
+ * three-finger strokes are generated as evdev frames at the given report
+ * rate and read through the driver's read_input path, with the driver
+ * timer running on the virtual clock in between. For every stage the
+ * time spent and the number of heap allocations are reported per frame.
+ * Timer callbacks are not frames: they are reported per callback, and
+ * the stages the timer runs within HandleState are left out of the
+ * per-frame numbers.
+ *
+ * Each scenario also reports how much of the finger travel came out as
+ * pointer motion. The slow 3-finger drag moves the fingers by a fraction
+ * of a unit per frame, out of step with each other, which shows motion
+ * lost to rounding the centroid deltas.
+ *
+ * The fingers' true position is known at every instant, so for every
+ * motion event the distance the pointer trails the fingers is measured
+ * as well, along with how far off the pointer is after the stroke. That
+ * is how MotionPredictionTime is evaluated: the lag should shrink by
+ * the distance the fingers move in that time, without an error at the
+ * end of the stroke. The lead is taken back after the lift, the largest
+ * motion event that does so is reported as well.
+ *
+ * In the 3-finger drag with a lift, the finger the single-touch axes
+ * follow is lifted halfway through the stroke and the axes jump to the
+ * next one, as the kernel's do. The drag follows the centroid and must
+ * not notice; with VelocityEstimator=1 the driver's speed estimate is
+ * reported against the fingers' speed to show it doesn't either.
+ *
+ * With VelocityEstimator=1 every scenario also reports the average
+ * acceleration SynapticsAccelerationProfile gives the motion events of the
+ * strokes, once with the driver's speed estimate and once with the speed
+ * the server would measure from the posted motion. At a constant finger
+ * speed the two should agree, AccelFactor means the same with either.
+ *
+ * The 2-finger fling is a scroll stroke with the touchpad switched off
+ * through the Synaptics Off property while the scrolling coasts on. It
+ * reports the scroll events that still came after that, which should be
+ * none.
+ *
+ * The driver's debug messages cost nothing when they are compiled out,
+ * and a compare each when they are compiled in but above the verbosity.
+ * synbench-log is built with all of them compiled in to compare the two,
+ * -v sets the verbosity to see the cost of the messages that are printed.
+ *
+ * Usage: synbench [-r rate] [-n strokes] [-v verbosity] [-o Option=Value ...]
+ */
+
+static void bench_stage_begin(int stage);
+static void bench_stage_end(int stage);
+
+#define STAGE_BEGIN(stage) \
+    do { bench_stage_begin(stage); stage_begin(priv, stage); } while (0)
+#define STAGE_END(stage) \
+    do { stage_end(priv, stage); bench_stage_end(stage); } while (0)
+
+#include "synaptics.c"
+
+#include <fcntl.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "fake-symbols.h"
+
+/* Length of a stroke and the idle time after it, in ms */
+#define STROKE_MS 200
+#define SLOW_STROKE_MS 2000
+#define IDLE_MS 400
+
+/* Finger speed in device units per ms, about 100 mm/s on the clickpad */
+#define SPEED 4.4
+
+/* Speed of a slow, precise drag, about 2 mm/s */
+#define SLOW_SPEED 0.088
+
+static const char *stage_names[STAGE_COUNT] = {
+    "ReadInput",
+    "EventReadHwState",
+    "HandleState",
+    "HandleTapProcessing",
+    "HandleScrolling",
+    "ComputeDeltas",
+    "post events",
+    "timer callback",
+};
+
+static struct {
+    double ns, start_ns;
+    unsigned long allocs, start_allocs;
+} stages[STAGE_COUNT];
+
+static unsigned long allocations;
+
+/* set while a timer callback is being timed */
+static Bool in_timer;
+
+/*
+ * Allocation counting. The program is linked with --wrap for these, so
+ * every call from the driver and the stub server layer comes here first.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+bench_stage_begin(int stage)
+{
+    if (in_timer)
+        return;
+    in_timer = (stage == STAGE_TIMER);
+    stages[stage].start_allocs = allocations;
+    stages[stage].start_ns = now_ns();
+}
+
+static void
+bench_stage_end(int stage)
+{
+    if (in_timer && stage != STAGE_TIMER)
+        return;
+    in_timer = FALSE;
+    stages[stage].ns += now_ns() - stages[stage].start_ns;
+    stages[stage].allocs += allocations - stages[stage].start_allocs;
+}
+
+/******************************************************************************
+ * Synthetic input
+ *****************************************************************************/
+
+static struct {
+    InputInfoRec info;
+    DeviceIntRec dev;
+    int fd;                     /* write end of the driver's pipe */
+    int tracking_id;
+    int fingers;                /* fingers down in the last frame */
+    uint32_t open_slots;        /* slots with a touch in the last frame */
+    unsigned long frames;
+
+    /* distance travelled by the fingers and by the pointer, in units */
+    double travel, motion;
+
+    /* the current stroke, and the pointer motion since it started */
+    CARD32 stroke_start;
+    int stroke_ms;
+    double vx, vy;
+    double px, py;
+
+    /* pointer lag behind the fingers during strokes, and error after them */
+    double lag, end_error;
+    unsigned long lag_samples;
+
+    /* ms into a stroke to lift the first finger at, 0 to keep it down,
+     * and the highest finger speed the driver estimated */
+    int lift_ms;
+    double max_velocity;
+
+    /* largest motion event after the lift */
+    double max_take_back;
+
+    /* acceleration SynapticsAccelerationProfile gives the motion events of
+     * the strokes, summed with the driver's speed estimate and with the
+     * server's, and when the last motion event came */
+    double accel_history, accel_server;
+    unsigned long accel_samples;
+    CARD32 last_motion;
+
+    /* ms after the lift to set Synaptics Off at, 0 to leave the pad on,
+     * and the scroll events posted before and after that */
+    int off_after_ms;
+    Bool off;
+    unsigned long scroll, scroll_off;
+} bench;
+
+struct frame {
+    struct input_event ev[64];
+    int nev;
+};
+
+static void
+frame_add(struct frame *f, int type, int code, int value)
+{
+    struct input_event *ev = &f->ev[f->nev++];
+
+    ev->time.tv_sec = fake_time / 1000;
+    ev->time.tv_usec = (fake_time % 1000) * 1000;
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+}
+
+/* Tool key for the number of fingers, as the kernel reports it */
+static int
+tool_key(int fingers)
+{
+    switch (fingers) {
+    case 1:
+        return BTN_TOOL_FINGER;
+    case 2:
+        return BTN_TOOL_DOUBLETAP;
+    case 3:
+        return BTN_TOOL_TRIPLETAP;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * The acceleration factor SynapticsAccelerationProfile gives for velocity
+ * with the given VelocityEstimator. The server's velocity is in units per
+ * corr_mul ms, as the driver sets it up. The server's acceleration is set
+ * high enough that MaxSpeed doesn't clip the factor.
+ */
+static double
+profile_accel(SynapticsPrivate * priv, int estimator, double velocity)
+{
+    DeviceVelocityRec vel = { .const_acceleration = 1.0, .corr_mul = 12.5 };
+    int saved = priv->synpara.velocity_estimator;
+    double accel;
+
+    priv->synpara.velocity_estimator = estimator;
+    accel = SynapticsAccelerationProfile(&bench.dev, &vel, velocity, 0, 1000.0);
+    priv->synpara.velocity_estimator = saved;
+
+    return accel;
+}
+
+static void
+event_hook(const struct fake_event *ev)
+{
+    SynapticsPrivate *priv;
+    double t, speed;
+
+    if (ev->type == FAKE_EV_SCROLL) {
+        if (bench.off)
+            bench.scroll_off++;
+        else
+            bench.scroll++;
+    }
+    if (ev->type != FAKE_EV_MOTION)
+        return;
+
+    /* the speed the event is accelerated for */
+    priv = bench.info.private;
+    bench.max_velocity = MAX(bench.max_velocity, priv->finger_velocity);
+
+    /* the server has no speed of its own here, it is modelled from the
+     * posted motion as the server measures it */
+    t = (int) (ev->millis - bench.last_motion);
+    if (priv->synpara.velocity_estimator == VELOCITY_HISTORY &&
+        bench.fingers && bench.last_motion && t > 0) {
+        speed = sqrt(ev->dx * ev->dx + ev->dy * ev->dy) * 12.5 / t;
+        bench.accel_history += profile_accel(priv, VELOCITY_HISTORY, 0);
+        bench.accel_server += profile_accel(priv, VELOCITY_SERVER, speed);
+        bench.accel_samples++;
+    }
+    bench.last_motion = ev->millis;
+
+    if (!bench.fingers)
+        bench.max_take_back = MAX(bench.max_take_back,
+                                  sqrt(ev->dx * ev->dx + ev->dy * ev->dy));
+
+    bench.motion += sqrt(ev->dx * ev->dx + ev->dy * ev->dy);
+    bench.px += ev->dx;
+    bench.py += ev->dy;
+
+    /* lag along the direction the fingers move in */
+    t = (int) (ev->millis - bench.stroke_start);
+    speed = sqrt(bench.vx * bench.vx + bench.vy * bench.vy);
+    if (t >= 0 && t <= bench.stroke_ms && speed > 0) {
+        bench.lag += ((bench.vx * t - bench.px) * bench.vx +
+                      (bench.vy * t - bench.py) * bench.vy) / speed;
+        bench.lag_samples++;
+    }
+}
+
+/*
+ * Post one frame at fake_time with fingers in the slots from first up to
+ * slots - 1, the one in slot 0 at x/y and the others lined up to its
+ * right. Each finger is offset by a different fraction of a unit, so
+ * slowly moving fingers don't all cross to the next unit in the same
+ * frame. The single-touch axes follow the finger in slot first. Running
+ * the timer up to fake_time is left to the caller.
+ */
+static void
+post_frame(int first, int slots, double x, double y)
+{
+    struct frame f = { .nev = 0 };
+    int fingers = slots - first;
+    int i;
+
+    for (i = 0; i < SYNAPTICS_MAX_SLOTS; i++) {
+        Bool down = i >= first && i < slots;
+
+        if (!down && !(bench.open_slots & (1U << i)))
+            continue;
+        frame_add(&f, EV_ABS, ABS_MT_SLOT, i);
+        if (!down) {
+            frame_add(&f, EV_ABS, ABS_MT_TRACKING_ID, -1);
+            bench.open_slots &= ~(1U << i);
+            continue;
+        }
+        if (!(bench.open_slots & (1U << i))) {
+            frame_add(&f, EV_ABS, ABS_MT_TRACKING_ID, bench.tracking_id++);
+            bench.open_slots |= 1U << i;
+        }
+        frame_add(&f, EV_ABS, ABS_MT_POSITION_X,
+                  x + i * 600 + (double) i / slots);
+        frame_add(&f, EV_ABS, ABS_MT_POSITION_Y, y + (double) i / slots);
+        frame_add(&f, EV_ABS, ABS_MT_PRESSURE, 60);
+    }
+
+    if (fingers != bench.fingers) {
+        if (!bench.fingers || !fingers)
+            frame_add(&f, EV_KEY, BTN_TOUCH, fingers > 0);
+        if (tool_key(bench.fingers) >= 0)
+            frame_add(&f, EV_KEY, tool_key(bench.fingers), 0);
+        if (tool_key(fingers) >= 0)
+            frame_add(&f, EV_KEY, tool_key(fingers), 1);
+    }
+
+    if (fingers) {
+        frame_add(&f, EV_ABS, ABS_X, x + first * 600 + (double) first / slots);
+        frame_add(&f, EV_ABS, ABS_Y, y + (double) first / slots);
+    }
+    frame_add(&f, EV_ABS, ABS_PRESSURE, fingers ? 60 : 0);
+    frame_add(&f, EV_ABS, ABS_TOOL_WIDTH, fingers == 1 ? 5 : 0);
+    frame_add(&f, EV_SYN, SYN_REPORT, 0);
+
+    bench.fingers = fingers;
+
+    if (write(bench.fd, f.ev, f.nev * sizeof(f.ev[0])) < 0) {
+        perror("write");
+        exit(1);
+    }
+
+    bench.info.read_input(&bench.info);
+    bench.frames++;
+}
+
+/*
+ * One stroke: put the fingers down, move them along dx/dy at the given
+ * speed for ms, lift them and let the pad idle for IDLE_MS.
+ */
+static void
+stroke(int fingers, double interval, int dx, int dy, double speed, int ms)
+{
+    double x = (FAKE_CLICKPAD_MIN_X + FAKE_CLICKPAD_MAX_X) / 2 - 600;
+    double y = (FAKE_CLICKPAD_MIN_Y + FAKE_CLICKPAD_MAX_Y) / 2;
+    CARD32 start = fake_time;
+    double t;
+
+    x -= dx * speed * ms / 2;
+    y -= dy * speed * ms / 2;
+
+    bench.stroke_start = start;
+    bench.stroke_ms = ms;
+    bench.vx = dx * speed;
+    bench.vy = dy * speed;
+    bench.px = 0;
+    bench.py = 0;
+
+    for (t = 0; t <= ms; t += interval) {
+        int first = bench.lift_ms > 0 && t >= bench.lift_ms;
+
+        fake_timer_run_until(start + (CARD32) t);
+        post_frame(first, fingers, x + dx * speed * t, y + dy * speed * t);
+    }
+    bench.travel += sqrt(dx * dx + dy * dy) * speed * (t - interval);
+
+    fake_timer_run_until(start + (CARD32) t);
+    post_frame(0, 0, 0, 0);
+
+    if (bench.off_after_ms > 0) {
+        CARD32 lift = fake_time;
+        int off = 1;
+
+        fake_timer_run_until(lift + bench.off_after_ms);
+        fake_property_set(&bench.dev, SYNAPTICS_PROP_OFF, &off, 1);
+        bench.off = TRUE;
+        fake_timer_run_until(lift + IDLE_MS);
+        off = 0;
+        fake_property_set(&bench.dev, SYNAPTICS_PROP_OFF, &off, 1);
+        bench.off = FALSE;
+    }
+    else
+        fake_timer_run_until(fake_time + IDLE_MS);
+
+    if (bench.lag_samples)
+        bench.end_error += sqrt(pow(bench.vx * (t - interval) - bench.px, 2) +
+                                pow(bench.vy * (t - interval) - bench.py, 2));
+}
+
+static void
+run(const char *name, int fingers, int dx, int dy, double speed, int ms,
+    int rate, int strokes)
+{
+    SynapticsPrivate *priv = bench.info.private;
+    unsigned long timer_fires = fake_timer_fires;
+    unsigned long callbacks;
+    int i;
+
+    memset(stages, 0, sizeof(stages));
+    bench.frames = 0;
+    bench.travel = 0;
+    bench.motion = 0;
+    bench.lag = 0;
+    bench.end_error = 0;
+    bench.lag_samples = 0;
+    bench.scroll = 0;
+    bench.scroll_off = 0;
+    bench.max_velocity = 0;
+    bench.max_take_back = 0;
+    bench.accel_history = 0;
+    bench.accel_server = 0;
+    bench.accel_samples = 0;
+
+    for (i = 0; i < strokes; i++) {
+        /* alternate directions so the fingers stay on the pad */
+        int dir = (i % 2) ? -1 : 1;
+
+        stroke(fingers, 1000.0 / rate, dir * dx, dir * dy, speed, ms);
+    }
+
+    callbacks = fake_timer_fires - timer_fires;
+    printf("%s: %d strokes of %d ms, %lu frames, %lu timer callbacks\n",
+           name, strokes, ms, bench.frames, callbacks);
+    printf("  %-20s %8.1f%% of %.0f units finger travel\n", "pointer motion",
+           bench.travel ? 100 * bench.motion / bench.travel : 0,
+           bench.travel);
+    if (bench.lag_samples)
+        printf("  %-20s %8.1f units behind the fingers, %.1f units off "
+               "after a stroke\n", "pointer lag", bench.lag / bench.lag_samples,
+               bench.end_error / strokes);
+    if (priv->synpara.predict_time > 0)
+        printf("  %-20s %8.1f units per event at most, %.1f per frame before\n",
+               "lead take-back", bench.max_take_back, speed * 1000.0 / rate);
+    if (priv->synpara.velocity_estimator == VELOCITY_HISTORY)
+        printf("  %-20s %8.2f units/ms at most, the fingers move at %.2f\n",
+               "estimated speed", bench.max_velocity, speed);
+    if (bench.accel_samples)
+        printf("  %-20s %8.3f on average with the driver's speed, %.3f with "
+               "the server's\n", "acceleration",
+               bench.accel_history / bench.accel_samples,
+               bench.accel_server / bench.accel_samples);
+    if (bench.off_after_ms > 0)
+        printf("  %-20s %8lu scroll events after Off, %lu before\n",
+               "touchpad off", bench.scroll_off, bench.scroll);
+    for (i = 0; i < STAGE_TIMER; i++)
+        printf("  %-20s %8.0f ns/frame %6.2f allocs/frame\n", stage_names[i],
+               stages[i].ns / bench.frames,
+               (double) stages[i].allocs / bench.frames);
+    printf("  %-20s %8.0f ns/call  %6.2f allocs/call\n",
+           stage_names[STAGE_TIMER],
+           callbacks ? stages[STAGE_TIMER].ns / callbacks : 0,
+           callbacks ? (double) stages[STAGE_TIMER].allocs / callbacks : 0);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: synbench [-r rate] [-n strokes] [-v verbosity]\n"
+            "                [-o Option=Value ...]\n"
+            "  -r  Report rate of the synthetic touchpad in Hz, at most 1000\n"
+            "      (default 1000).\n"
+            "  -n  Number of strokes per scenario (default 200), a tenth of\n"
+            "      that for the slow drag.\n"
+            "  -v  Print driver messages up to the given verbosity.\n"
+            "  -o  Set a driver option, as in an InputClass section.\n");
+    exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rate = 1000, strokes = 200;
+    int fds[2];
+    int c;
+
+    while ((c = getopt(argc, argv, "r:n:v:o:")) != -1) {
+        switch (c) {
+        case 'r':
+            rate = atoi(optarg);
+            if (rate <= 0 || rate > 1000)
+                usage();
+            break;
+        case 'n':
+            strokes = atoi(optarg);
+            if (strokes <= 0)
+                usage();
+            break;
+        case 'v':
+            fake_verbosity = atoi(optarg);
+            break;
+        case 'o':
+        {
+            char *value = strchr(optarg, '=');
+
+            if (!value)
+                usage();
+            *value++ = '\0';
+            fake_option_set(optarg, value);
+            break;
+        }
+        default:
+            usage();
+        }
+    }
+    if (optind != argc)
+        usage();
+
+    fake_evdev_load_clickpad();
+
+    if (pipe(fds) < 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    fake_serial_fd = fds[0];
+    fake_event_hook = event_hook;
+    bench.fd = fds[1];
+    fake_option_set("Protocol", "event");
+    fake_option_set("Device", "synthetic");
+
+    bench.info.name = "bench";
+    bench.info.fd = -1;
+    bench.info.dev = &bench.dev;
+    bench.dev.public.devicePrivate = &bench.info;
+    fake_time = 1000;
+
+    if (SYNAPTICS.PreInit(&SYNAPTICS, &bench.info, 0) != Success) {
+        fprintf(stderr, "PreInit failed\n");
+        return 1;
+    }
+    if (bench.info.device_control(&bench.dev, DEVICE_INIT) != Success ||
+        bench.info.device_control(&bench.dev, DEVICE_ON) != Success) {
+        fprintf(stderr, "failed to enable device\n");
+        return 1;
+    }
+
+    printf("# %d Hz, debug messages up to verbosity %d compiled in, "
+           "verbosity %d\n", rate, SYNAPTICS_MAX_LOG_LEVEL, fake_verbosity);
+    run("1 finger motion", 1, 1, 1, SPEED, STROKE_MS, rate, strokes);
+    run("2 finger scroll", 2, 0, 1, SPEED, STROKE_MS, rate, strokes);
+    bench.off_after_ms = 50;
+    run("2 finger fling, Off", 2, 0, 1, SPEED, STROKE_MS, rate, strokes);
+    bench.off_after_ms = 0;
+    run("3 finger drag", 3, 1, 0, SPEED, STROKE_MS, rate, strokes);
+    bench.lift_ms = STROKE_MS / 2;
+    run("3 finger drag, lift", 3, 1, 0, SPEED, STROKE_MS, rate, strokes);
+    bench.lift_ms = 0;
+    run("slow 3 finger drag", 3, 1, 0, SLOW_SPEED, SLOW_STROKE_MS, rate,
+        strokes / 10 ? strokes / 10 : 1);
+
+    bench.info.device_control(&bench.dev, DEVICE_OFF);
+    bench.info.device_control(&bench.dev, DEVICE_CLOSE);
+    SYNAPTICS.UnInit(&SYNAPTICS, &bench.info, 0);
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * synreplay - feed an evemu recording through the driver offline.
+ *
+ * The driver sources are linked against the stub server layer in
+ * fake-symbols.c. The recording's device description stands in for the
+ * kernel device, its events are written frame by frame into a pipe the
+ * driver reads from, and the driver's timer runs on a virtual clock that
+ * follows the recording's timestamps. Every motion, button and scroll
+ * event the driver posts is printed with its virtual timestamp, followed
+ * by a summary of the time spent in the driver and the touch-to-event
+ * latencies. With -t the driver's state trace is printed last.
+ *
+ * The summary also checks that the second click of a double click lands
+ * where the first one did. The server accelerates every motion event by
+ * a gain that grows with its size, which the replay stands in for with a
+ * gain of its own, so motion that is undone by events of different sizes
+ * than the ones it consisted of shows up as drift.
+ *
+ * Usage: synreplay [-q] [-t] [-v level] [-o Option=Value ...] recording
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include <xorg-server.h>
+#include <xf86Xinput.h>
+
+#include "synaptics-properties.h"
+#include "tapndrag.h"
+#include "fake-symbols.h"
+
+extern InputDriverRec SYNAPTICS;
+
+/* How long to keep running the timer after the last event, in ms */
+#define DRAIN_MS 2000
+
+/* Presses of a button closer together than this are a double click, in ms,
+ * the usual toolkit default */
+#define DOUBLE_CLICK_MS 400
+
+/* Gain standing in for pointer acceleration, for motion events of size d */
+#define ACCEL_GAIN(d) (1 + (d) / 32)
+
+struct latency {
+    unsigned long count;
+    double total, max;
+};
+
+static struct {
+    Bool quiet;
+
+    unsigned long motion, buttons, scroll;
+    double motion_dx, motion_dy;
+
+    /* start of the most recent touch sequence, and whether it has already
+     * produced motion or a button press */
+    Bool touched, touching;
+    CARD32 touch_start;
+    Bool seen_motion, seen_button;
+    struct latency motion_latency, button_latency;
+
+    /* pointer position with ACCEL_GAIN applied, and where and when the
+     * last button press happened */
+    double accel_x, accel_y;
+    int press_button;
+    CARD32 press_millis;
+    double press_x, press_y;
+    unsigned long double_clicks;
+    double double_click_drift;
+} replay;
+
+static void
+latency_add(struct latency *l, double ms)
+{
+    l->count++;
+    l->total += ms;
+    if (ms > l->max)
+        l->max = ms;
+}
+
+static void
+latency_print(const char *what, const struct latency *l)
+{
+    if (!l->count)
+        printf("# touch to first %s: none\n", what);
+    else
+        printf("# touch to first %s: %.1f ms mean, %.1f ms max (%lu touches)\n",
+               what, l->total / l->count, l->max, l->count);
+}
+
+static void
+event_hook(const struct fake_event *ev)
+{
+    double gain, drift;
+
+    switch (ev->type) {
+    case FAKE_EV_MOTION:
+        replay.motion++;
+        replay.motion_dx += ev->dx;
+        replay.motion_dy += ev->dy;
+        gain = ACCEL_GAIN(sqrt(ev->dx * ev->dx + ev->dy * ev->dy));
+        replay.accel_x += ev->dx * gain;
+        replay.accel_y += ev->dy * gain;
+        if (replay.touched && !replay.seen_motion) {
+            latency_add(&replay.motion_latency, ev->millis - replay.touch_start);
+            replay.seen_motion = TRUE;
+        }
+        if (!replay.quiet)
+            printf("%10u motion %+.3f %+.3f\n", (unsigned) ev->millis,
+                   ev->dx, ev->dy);
+        break;
+    case FAKE_EV_BUTTON:
+        if (ev->is_down) {
+            replay.buttons++;
+            if (ev->button == replay.press_button &&
+                ev->millis - replay.press_millis < DOUBLE_CLICK_MS) {
+                drift = sqrt(pow(replay.accel_x - replay.press_x, 2) +
+                             pow(replay.accel_y - replay.press_y, 2));
+                if (drift > replay.double_click_drift)
+                    replay.double_click_drift = drift;
+                replay.double_clicks++;
+            }
+            replay.press_button = ev->button;
+            replay.press_millis = ev->millis;
+            replay.press_x = replay.accel_x;
+            replay.press_y = replay.accel_y;
+            if (replay.touched && !replay.seen_button) {
+                latency_add(&replay.button_latency,
+                            ev->millis - replay.touch_start);
+                replay.seen_button = TRUE;
+            }
+        }
+        if (!replay.quiet)
+            printf("%10u button %d %s\n", (unsigned) ev->millis, ev->button,
+                   ev->is_down ? "down" : "up");
+        break;
+    case FAKE_EV_SCROLL:
+        replay.scroll++;
+        if (!replay.quiet)
+            printf("%10u scroll %+.3f %+.3f\n", (unsigned) ev->millis,
+                   ev->dx, ev->dy);
+        break;
+    }
+}
+
+static CARD32
+event_millis(const struct input_event *ev)
+{
+    return 1000 * ev->time.tv_sec + ev->time.tv_usec / 1000;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: synreplay [-q] [-t] [-v level] [-o Option=Value ...] "
+            "recording\n"
+            "  -q  Don't print the posted events, only the summary.\n"
+            "  -t  Print the tap and moving state changes the driver traced.\n"
+            "  -v  Print driver messages up to the given verbosity.\n"
+            "  -o  Set a driver option, as in an InputClass section.\n");
+    exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    InputInfoRec info;
+    DeviceIntRec dev;
+    const struct input_event *events;
+    size_t nevents, i, start;
+    int fds[2];
+    int c;
+    unsigned long frames = 0;
+    double ns, read_ns = 0, read_max_ns = 0, timer_ns = 0;
+    CARD32 expires;
+    int rate, fires[2];
+    int trace[2 * SYNAPTICS_TRACE_SIZE], ntrace = 0;
+    Bool show_trace = FALSE;
+
+    while ((c = getopt(argc, argv, "qtv:o:")) != -1) {
+        switch (c) {
+        case 'q':
+            replay.quiet = TRUE;
+            break;
+        case 't':
+            show_trace = TRUE;
+            break;
+        case 'v':
+            fake_verbosity = atoi(optarg);
+            break;
+        case 'o':
+        {
+            char *value = strchr(optarg, '=');
+
+            if (!value)
+                usage();
+            *value++ = '\0';
+            fake_option_set(optarg, value);
+            break;
+        }
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    if (!fake_evdev_load(argv[optind]))
+        return 1;
+    events = fake_evdev_events(&nevents);
+    if (!nevents) {
+        fprintf(stderr, "%s: no events in recording\n", argv[optind]);
+        return 1;
+    }
+
+    if (pipe(fds) < 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    fake_serial_fd = fds[0];
+    fake_event_hook = event_hook;
+    fake_option_set("Protocol", "event");
+    fake_option_set("Device", argv[optind]);
+
+    memset(&info, 0, sizeof(info));
+    memset(&dev, 0, sizeof(dev));
+    info.name = "replay";
+    info.fd = -1;
+    info.dev = &dev;
+    dev.public.devicePrivate = &info;
+
+    fake_time = event_millis(&events[0]);
+
+    if (SYNAPTICS.PreInit(&SYNAPTICS, &info, 0) != Success) {
+        fprintf(stderr, "PreInit failed\n");
+        return 1;
+    }
+    if (info.device_control(&dev, DEVICE_INIT) != Success ||
+        info.device_control(&dev, DEVICE_ON) != Success) {
+        fprintf(stderr, "failed to enable device\n");
+        return 1;
+    }
+
+    for (start = 0, i = 0; i < nevents; i++) {
+        const struct input_event *ev = &events[i];
+        CARD32 millis;
+        size_t j;
+
+        if (ev->type != EV_SYN || ev->code != SYN_REPORT)
+            continue;
+
+        millis = event_millis(ev);
+        ns = now_ns();
+        fake_timer_run_until(millis);
+        timer_ns += now_ns() - ns;
+
+        for (j = start; j < i; j++) {
+            if (events[j].type != EV_KEY || events[j].code != BTN_TOUCH)
+                continue;
+            if (events[j].value && !replay.touching) {
+                replay.touched = TRUE;
+                replay.touch_start = millis;
+                replay.seen_motion = FALSE;
+                replay.seen_button = FALSE;
+            }
+            replay.touching = events[j].value;
+        }
+
+        if (write(fds[1], &events[start], (i - start + 1) * sizeof(*ev)) < 0) {
+            perror("write");
+            return 1;
+        }
+        start = i + 1;
+
+        ns = now_ns();
+        info.read_input(&info);
+        ns = now_ns() - ns;
+
+        read_ns += ns;
+        if (ns > read_max_ns)
+            read_max_ns = ns;
+        frames++;
+    }
+
+    /* let pending taps, coasting and button emulation time out */
+    ns = now_ns();
+    while (fake_timer_expiry(&expires) &&
+           (int) (expires - fake_time) <= DRAIN_MS)
+        fake_timer_run_until(expires);
+    timer_ns += now_ns() - ns;
+
+    if (fake_property_get(&dev, SYNAPTICS_PROP_REPORT_RATE, &rate, 1) != 1)
+        rate = 0;
+    if (fake_property_get(&dev, SYNAPTICS_PROP_TIMER_FIRES, fires, 2) != 2)
+        fires[0] = fires[1] = 0;
+    if (show_trace)
+        ntrace = fake_property_get(&dev, SYNAPTICS_PROP_STATE_TRACE, trace,
+                                   2 * SYNAPTICS_TRACE_SIZE);
+
+    info.device_control(&dev, DEVICE_OFF);
+    info.device_control(&dev, DEVICE_CLOSE);
+    SYNAPTICS.UnInit(&SYNAPTICS, &info, 0);
+
+    printf("# frames: %lu, timer callbacks: %lu (%d spurious), "
+           "report rate: %d Hz\n", frames, fake_timer_fires, fires[1], rate);
+    printf("# ReadInput: %.0f ns/frame mean, %.0f ns max\n",
+           frames ? read_ns / frames : 0, read_max_ns);
+    printf("# timer: %.0f ns/callback mean\n",
+           fake_timer_fires ? timer_ns / fake_timer_fires : 0);
+    printf("# events: %lu motion (total %+.3f %+.3f), %lu button presses, "
+           "%lu scroll\n", replay.motion, replay.motion_dx, replay.motion_dy,
+           replay.buttons, replay.scroll);
+    latency_print("motion", &replay.motion_latency);
+    latency_print("button press", &replay.button_latency);
+    printf("# double clicks: %lu, second click up to %.3f units from the "
+           "first\n", replay.double_clicks, replay.double_click_drift);
+
+    for (i = 0; i + 1 < ntrace; i += 2) {
+        CARD32 state = trace[i + 1];
+
+        printf("# trace %u: %s -> %s, %u fingers, moving %u, 3fd %u\n",
+               (CARD32) trace[i], tap_state_names[state & 0xff],
+               tap_state_names[(state >> 8) & 0xff], (state >> 16) & 0xff,
+               (state >> 24) & 0x7f, state >> 31);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return 0;
+}
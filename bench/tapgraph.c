@@ -0,0 +1,280 @@
+/*
+ * tapgraph - draw the tap and drag state machine as a Dia diagram.
+ *
+ * Reads the transition table in src/tapndrag.c and writes a diagram with
+ * one box per state and one arrow per pair of states that has
+ * transitions, labelled with the inputs, the action and "(r)" for rows
+ * that evaluate the new state again on the same frame. Rows that only
+ * run an action are listed inside the box of their state. States are
+ * laid out by their distance from TS_START.
+ *
+ * Usage: tapgraph > docs/tapndrag.dia
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tapndrag.h"
+
+#define BOX_WIDTH 9.0
+#define LINE_HEIGHT 0.8
+#define COLUMN 16.0
+#define ROW 10.0
+
+struct box {
+    int depth, column;
+    double x, y, height;
+};
+
+static struct box boxes[TAP_STATE_COUNT];
+
+static void
+put_escaped(const char *s)
+{
+    for (; *s; s++) {
+        switch (*s) {
+        case '&':
+            fputs("&amp;", stdout);
+            break;
+        case '<':
+            fputs("&lt;", stdout);
+            break;
+        case '>':
+            fputs("&gt;", stdout);
+            break;
+        case '#':
+            /* delimits Dia strings */
+            break;
+        default:
+            putchar(*s);
+        }
+    }
+}
+
+/* "touch & !press / move (r)" */
+static void
+describe(const struct TapTransition *t, char *buf, size_t len)
+{
+    int bit;
+
+    buf[0] = '\0';
+    for (bit = 0; bit < TAP_INPUT_COUNT; bit++) {
+        if (!((t->all | t->none) & (1 << bit)))
+            continue;
+        snprintf(buf + strlen(buf), len - strlen(buf), "%s%s%s",
+                 buf[0] ? " & " : "", (t->none & (1 << bit)) ? "!" : "",
+                 tap_input_names[bit]);
+    }
+    if (!buf[0])
+        snprintf(buf, len, "always");
+    if (t->action != TA_NONE)
+        snprintf(buf + strlen(buf), len - strlen(buf), " / %s",
+                 tap_action_names[t->action]);
+    if ((t->flags & TR_RESTART) && !(t->flags & TR_STAY))
+        snprintf(buf + strlen(buf), len - strlen(buf), " (r)");
+}
+
+static void
+text_object(int id, double x, double y, const char *text)
+{
+    printf("    <dia:object type=\"Standard - Text\" version=\"1\" id=\"O%d\">\n"
+           "      <dia:attribute name=\"obj_pos\">\n"
+           "        <dia:point val=\"%g,%g\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"text\">\n"
+           "        <dia:composite type=\"text\">\n"
+           "          <dia:attribute name=\"string\">\n"
+           "            <dia:string>#", id, x, y);
+    put_escaped(text);
+    printf("#</dia:string>\n"
+           "          </dia:attribute>\n"
+           "          <dia:attribute name=\"font\">\n"
+           "            <dia:font family=\"sans\" style=\"0\" name=\"Helvetica\"/>\n"
+           "          </dia:attribute>\n"
+           "          <dia:attribute name=\"height\">\n"
+           "            <dia:real val=\"%g\"/>\n"
+           "          </dia:attribute>\n"
+           "          <dia:attribute name=\"pos\">\n"
+           "            <dia:point val=\"%g,%g\"/>\n"
+           "          </dia:attribute>\n"
+           "          <dia:attribute name=\"color\">\n"
+           "            <dia:color val=\"#000000\"/>\n"
+           "          </dia:attribute>\n"
+           "          <dia:attribute name=\"alignment\">\n"
+           "            <dia:enum val=\"1\"/>\n"
+           "          </dia:attribute>\n"
+           "        </dia:composite>\n"
+           "      </dia:attribute>\n"
+           "    </dia:object>\n", LINE_HEIGHT * 0.8, x, y);
+}
+
+static void
+box_object(int id, const struct box *b)
+{
+    printf("    <dia:object type=\"Standard - Box\" version=\"0\" id=\"O%d\">\n"
+           "      <dia:attribute name=\"obj_pos\">\n"
+           "        <dia:point val=\"%g,%g\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"elem_corner\">\n"
+           "        <dia:point val=\"%g,%g\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"elem_width\">\n"
+           "        <dia:real val=\"%g\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"elem_height\">\n"
+           "        <dia:real val=\"%g\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"corner_radius\">\n"
+           "        <dia:real val=\"0.5\"/>\n"
+           "      </dia:attribute>\n"
+           "    </dia:object>\n",
+           id, b->x, b->y, b->x, b->y, BOX_WIDTH, b->height);
+}
+
+static void
+line_object(int id, int from, int to)
+{
+    const struct box *a = &boxes[from], *b = &boxes[to];
+
+    printf("    <dia:object type=\"Standard - Line\" version=\"0\" id=\"O%d\">\n"
+           "      <dia:attribute name=\"obj_pos\">\n"
+           "        <dia:point val=\"%g,%g\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"conn_endpoints\">\n"
+           "        <dia:point val=\"%g,%g\"/>\n"
+           "        <dia:point val=\"%g,%g\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"end_arrow\">\n"
+           "        <dia:enum val=\"1\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"end_arrow_length\">\n"
+           "        <dia:real val=\"0.8\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:attribute name=\"end_arrow_width\">\n"
+           "        <dia:real val=\"0.8\"/>\n"
+           "      </dia:attribute>\n"
+           "      <dia:connections>\n"
+           "        <dia:connection handle=\"0\" to=\"O%d\" connection=\"8\"/>\n"
+           "        <dia:connection handle=\"1\" to=\"O%d\" connection=\"8\"/>\n"
+           "      </dia:connections>\n"
+           "    </dia:object>\n", id,
+           a->x + BOX_WIDTH / 2, a->y + a->height / 2,
+           a->x + BOX_WIDTH / 2, a->y + a->height / 2,
+           b->x + BOX_WIDTH / 2, b->y + b->height / 2, 2 * from, 2 * to);
+}
+
+static void
+layout(void)
+{
+    int queue[TAP_STATE_COUNT], head = 0, tail = 0;
+    int columns[TAP_STATE_COUNT] = { 0 };
+    int s, i;
+
+    for (s = 0; s < TAP_STATE_COUNT; s++)
+        boxes[s].depth = -1;
+
+    boxes[TS_START].depth = 0;
+    queue[tail++] = TS_START;
+    while (head < tail) {
+        s = queue[head++];
+        for (i = tap_state_rows[s]; i < tap_state_rows[s + 1]; i++) {
+            int next = tap_transitions[i].next;
+
+            if (boxes[next].depth < 0) {
+                boxes[next].depth = boxes[s].depth + 1;
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    for (s = 0; s < TAP_STATE_COUNT; s++) {
+        int stays = 0;
+
+        if (boxes[s].depth < 0)
+            boxes[s].depth = TAP_STATE_COUNT - 1;
+        boxes[s].column = columns[boxes[s].depth]++;
+        for (i = tap_state_rows[s]; i < tap_state_rows[s + 1]; i++)
+            if (tap_transitions[i].flags & TR_STAY)
+                stays++;
+        boxes[s].x = boxes[s].column * COLUMN;
+        boxes[s].y = boxes[s].depth * ROW;
+        boxes[s].height = (2 + stays) * LINE_HEIGHT;
+    }
+}
+
+int
+main(void)
+{
+    const char *error;
+    int id = 2 * TAP_STATE_COUNT;
+    int s, to, i;
+
+    if (!TapTableInit(&error)) {
+        fprintf(stderr, "tapgraph: bad tap state table: %s\n", error);
+        return 1;
+    }
+
+    layout();
+
+    printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+           "<!-- Generated by bench/tapgraph from src/tapndrag.c -->\n"
+           "<dia:diagram xmlns:dia=\"http://www.lysator.liu.se/~alla/dia/\">\n"
+           "  <dia:diagramdata>\n"
+           "    <dia:attribute name=\"background\">\n"
+           "      <dia:color val=\"#ffffff\"/>\n"
+           "    </dia:attribute>\n"
+           "  </dia:diagramdata>\n"
+           "  <dia:layer name=\"Background\" visible=\"true\" active=\"true\">\n");
+
+    /* boxes are O0, O2, ..., their titles O1, O3, ... */
+    for (s = 0; s < TAP_STATE_COUNT; s++) {
+        char title[1024], line[256];
+
+        snprintf(title, sizeof(title), "TS_%s", tap_state_names[s]);
+        for (i = tap_state_rows[s]; i < tap_state_rows[s + 1]; i++) {
+            if (!(tap_transitions[i].flags & TR_STAY))
+                continue;
+            describe(&tap_transitions[i], line, sizeof(line));
+            snprintf(title + strlen(title), sizeof(title) - strlen(title),
+                     "\n%s", line);
+        }
+        box_object(2 * s, &boxes[s]);
+        text_object(2 * s + 1, boxes[s].x + BOX_WIDTH / 2,
+                    boxes[s].y + 1.25 * LINE_HEIGHT, title);
+    }
+
+    for (s = 0; s < TAP_STATE_COUNT; s++) {
+        for (to = 0; to < TAP_STATE_COUNT; to++) {
+            char label[1024] = "", line[256];
+            double x, y;
+
+            for (i = tap_state_rows[s]; i < tap_state_rows[s + 1]; i++) {
+                const struct TapTransition *t = &tap_transitions[i];
+
+                if (t->next != to || (t->flags & TR_STAY))
+                    continue;
+                describe(t, line, sizeof(line));
+                snprintf(label + strlen(label), sizeof(label) - strlen(label),
+                         "%s%s", label[0] ? "\n" : "", line);
+            }
+            if (!label[0])
+                continue;
+
+            line_object(id++, s, to);
+            /* a bit towards the source, so the labels of a pair of
+             * opposite arrows don't overlap */
+            x = (2 * boxes[s].x + boxes[to].x) / 3 + BOX_WIDTH / 2;
+            y = (2 * boxes[s].y + boxes[to].y) / 3 + ROW / 4;
+            text_object(id++, x, y, label);
+        }
+    }
+
+    printf("  </dia:layer>\n"
+           "</dia:diagram>\n");
+
+    return 0;
+}
@@ -158,4 +158,33 @@
 /* 32 Bit Integer, 2 values, horizontal hysteresis, vertical hysteresis */
 #define SYNAPTICS_PROP_NOISE_CANCELLATION "Synaptics Noise Cancellation"
 
+/* 32 bit, 2 values, delay, commit move */
+#define SYNAPTICS_PROP_THREE_FINGER_DRAG "Synaptics Three-Finger Drag"
+
+/* 32 bit, 1 value (read-only), measured report rate in Hz, 0 if unknown */
+#define SYNAPTICS_PROP_REPORT_RATE "Synaptics Report Rate"
+
+/* 32 bit unsigned, 2 values (read-only), timer wakeups, wakeups that changed
+ * nothing */
+#define SYNAPTICS_PROP_TIMER_FIRES "Synaptics Timer Fires"
+
+/* 8 bit (BOOL), 1 value, count the Synaptics Stage Latency histograms */
+#define SYNAPTICS_PROP_STAGE_TIMING "Synaptics Stage Timing"
+
+/* 32 bit unsigned, 8 rows of 16 values (read-only), latency histogram of
+ * each stage of input processing: reading input, reading a frame,
+ * HandleState, tap processing, scrolling, deltas, posting events, timer
+ * callbacks. Bucket 0
+ * counts durations below 128 ns, bucket n durations from 64 * 2^n ns up to
+ * twice that, bucket 15 everything longer. Setting all values to 0 resets
+ * the histograms. */
+#define SYNAPTICS_PROP_STAGE_LATENCY "Synaptics Stage Latency"
+
+/* 32 bit unsigned, 2 values per record (read-only), the last changes of
+ * the tap and moving state, oldest first. Each record is the time in ms
+ * and a state word: old tap state in bits 0-7, new tap state in bits 8-15,
+ * number of fingers in bits 16-23, moving state in bits 24-30 and bit 31
+ * set during a 3-finger drag. */
+#define SYNAPTICS_PROP_STATE_TRACE "Synaptics State Trace"
+
 #endif                          /* _SYNAPTICS_PROPERTIES_H_ */
@@ -70,6 +70,10 @@
 #define ABS_MT_MAX ABS_MT_TOOL_Y
 #define ABS_MT_CNT (ABS_MT_MAX - ABS_MT_MIN + 1)
 
+/* Events read from the device in one go. A frame of a five-finger
+ * touchpad is around 60 events, so this holds a few of them. */
+#define EVENT_BUFFER_SIZE 256
+
 /**
  * Protocol-specific data.
  */
@@ -84,15 +88,33 @@ struct eventcomm_proto_data {
     double st_to_mt_scale[2];
     int axis_map[ABS_MT_CNT];
     int cur_slot;
-    ValuatorMask **last_mt_vals;
+    int *last_mt_vals;          /* per slot, the last value of each axis,
+                                   indexed by axis_map */
+    int *tracking_ids;          /* per slot, -1 if the slot is closed */
     int num_touches;
 
+    /**
+     * Events are read from the fd directly into this buffer, one read()
+     * for everything the kernel has queued. libevdev only provides the
+     * events of a resync after SYN_DROPPED, read_flag is
+     * LIBEVDEV_READ_FLAG_SYNC while that is in progress.
+     */
+    struct input_event events[EVENT_BUFFER_SIZE];
+    int events_pos;
+    int events_len;
+
     struct libevdev *evdev;
     enum libevdev_read_flag read_flag;
 
     int have_monotonic_clock;
 };
 
+/* Values per slot in last_mt_vals: x, y, the two scroll axes and the other
+ * MT axes, the same numbering as axis_map */
+#define MT_VALS_STRIDE(priv) (4 + (priv)->num_mt_axes)
+#define LAST_MT_VALS(proto_data, priv, slot) \
+    ((proto_data)->last_mt_vals + (slot) * MT_VALS_STRIDE(priv))
+
 #ifdef HAVE_LIBEVDEV_DEVICE_LOG_FUNCS
 static void
 libevdev_log_func(const struct libevdev *dev,
@@ -177,14 +199,11 @@ UninitializeTouch(InputInfoPtr pInfo)
     if (!priv->has_touch)
         return;
 
-    if (proto_data->last_mt_vals) {
-        int i;
+    free(proto_data->last_mt_vals);
+    proto_data->last_mt_vals = NULL;
 
-        for (i = 0; i < priv->num_slots; i++)
-            valuator_mask_free(&proto_data->last_mt_vals[i]);
-        free(proto_data->last_mt_vals);
-        proto_data->last_mt_vals = NULL;
-    }
+    free(proto_data->tracking_ids);
+    proto_data->tracking_ids = NULL;
 
     proto_data->num_touches = 0;
 }
@@ -203,32 +222,25 @@ InitializeTouch(InputInfoPtr pInfo)
     proto_data->cur_slot = libevdev_get_current_slot(proto_data->evdev);
     proto_data->num_touches = 0;
 
-    proto_data->last_mt_vals = calloc(priv->num_slots, sizeof(ValuatorMask *));
+    proto_data->last_mt_vals = calloc(priv->num_slots,
+                                      MT_VALS_STRIDE(priv) * sizeof(int));
     if (!proto_data->last_mt_vals) {
         xf86IDrvMsg(pInfo, X_WARNING,
-                    "failed to allocate MT last values mask array\n");
+                    "failed to allocate MT last values array\n");
         UninitializeTouch(pInfo);
         return;
     }
 
-    for (i = 0; i < priv->num_slots; i++) {
-        int j;
-
-        proto_data->last_mt_vals[i] = valuator_mask_new(4 + priv->num_mt_axes);
-        if (!proto_data->last_mt_vals[i]) {
-            xf86IDrvMsg(pInfo, X_WARNING,
-                        "failed to allocate MT last values mask\n");
-            UninitializeTouch(pInfo);
-            return;
-        }
-
-        /* Axes 0-4 are for X, Y, and scrolling. num_mt_axes does not include X
-         * and Y. */
-        valuator_mask_set(proto_data->last_mt_vals[i], 0, 0);
-        valuator_mask_set(proto_data->last_mt_vals[i], 1, 0);
-        for (j = 0; j < priv->num_mt_axes; j++)
-            valuator_mask_set(proto_data->last_mt_vals[i], 4 + j, 0);
+    proto_data->tracking_ids = malloc(priv->num_slots * sizeof(int));
+    if (!proto_data->tracking_ids) {
+        xf86IDrvMsg(pInfo, X_WARNING,
+                    "failed to allocate MT tracking ID array\n");
+        UninitializeTouch(pInfo);
+        return;
     }
+
+    for (i = 0; i < priv->num_slots; i++)
+        proto_data->tracking_ids[i] = -1;
 }
 
 static Bool
@@ -254,6 +266,10 @@ EventDeviceOnHook(InputInfoPtr pInfo, SynapticsParameters * para)
     } else
         libevdev_set_fd(proto_data->evdev, pInfo->fd);
 
+    /* anything still buffered is from before the device was disabled */
+    proto_data->events_pos = 0;
+    proto_data->events_len = 0;
+    proto_data->read_flag = LIBEVDEV_READ_FLAG_NORMAL;
 
     if (para->grab_event_device) {
         /* Try to grab the event device so that data don't leak to /dev/input/mice */
@@ -544,34 +560,138 @@ EventQueryHardware(InputInfoPtr pInfo)
     return TRUE;
 }
 
+/**
+ * Refill the event buffer with a single read() of everything the kernel
+ * has queued for us.
+ *
+ * @return FALSE if no events are available.
+ */
 static Bool
-SynapticsReadEvent(InputInfoPtr pInfo, struct input_event *ev)
+EventFillBuffer(InputInfoPtr pInfo, struct eventcomm_proto_data *proto_data)
+{
+    ssize_t len;
+
+    SYSCALL(len = read(pInfo->fd, proto_data->events,
+                       sizeof(proto_data->events)));
+    if (len <= 0) {
+        if (len < 0 && errno != EAGAIN)
+            LogMessageVerbSigSafe(X_ERROR, 0, "%s: Read error %d\n",
+                                  pInfo->name, errno);
+        return FALSE;
+    }
+
+    /* evdev never returns partial events */
+    if (len % sizeof(struct input_event) != 0) {
+        LogMessageVerbSigSafe(X_ERROR, 0, "%s: Read error, short read\n",
+                              pInfo->name);
+        return FALSE;
+    }
+
+    proto_data->events_pos = 0;
+    proto_data->events_len = len / sizeof(struct input_event);
+
+    return TRUE;
+}
+
+/**
+ * libevdev doesn't see the events we read from the buffer, so its idea of
+ * the device state is whatever it was at the last resync. Update it to the
+ * state we have processed so the resync reports exactly what changed
+ * while events were dropped.
+ */
+static void
+EventUpdateLibevdevState(InputInfoPtr pInfo, const struct CommData *comm)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
+    struct libevdev *evdev = proto_data->evdev;
+    const struct SynapticsHwState *hw = comm->hwState;
+    int i;
+
+    libevdev_set_event_value(evdev, EV_KEY, BTN_LEFT, hw->left);
+    libevdev_set_event_value(evdev, EV_KEY, BTN_RIGHT, hw->right);
+    libevdev_set_event_value(evdev, EV_KEY, BTN_MIDDLE, hw->middle);
+    libevdev_set_event_value(evdev, EV_KEY, BTN_FORWARD, hw->up);
+    libevdev_set_event_value(evdev, EV_KEY, BTN_BACK, hw->down);
+    for (i = 0; i < 8; i++)
+        libevdev_set_event_value(evdev, EV_KEY, BTN_0 + i, hw->multi[i]);
+    libevdev_set_event_value(evdev, EV_KEY, BTN_TOOL_FINGER, comm->oneFinger);
+    libevdev_set_event_value(evdev, EV_KEY, BTN_TOOL_DOUBLETAP,
+                             comm->twoFingers);
+    libevdev_set_event_value(evdev, EV_KEY, BTN_TOOL_TRIPLETAP,
+                             comm->threeFingers);
+    /* BTN_TOUCH is only used without pressure, then z is 0 or finger_high */
+    libevdev_set_event_value(evdev, EV_KEY, BTN_TOUCH, hw->z > 0);
+
+    if (!priv->has_touch || !proto_data->last_mt_vals)
+        return;
+
+    for (i = 0; i < priv->num_slots; i++) {
+        const int *vals = LAST_MT_VALS(proto_data, priv, i);
+        int axis;
+
+        libevdev_set_slot_value(evdev, i, ABS_MT_TRACKING_ID,
+                                proto_data->tracking_ids[i]);
+
+        for (axis = ABS_MT_TOUCH_MAJOR; axis <= ABS_MT_MAX; axis++) {
+            int map = proto_data->axis_map[axis - ABS_MT_TOUCH_MAJOR];
+
+            if (axis == ABS_MT_TRACKING_ID ||
+                !libevdev_has_event_code(evdev, EV_ABS, axis))
+                continue;
+
+            libevdev_set_slot_value(evdev, i, axis, vals[map]);
+        }
+    }
+
+    if (proto_data->cur_slot >= 0)
+        libevdev_set_event_value(evdev, EV_ABS, ABS_MT_SLOT,
+                                 proto_data->cur_slot);
+}
+
+static Bool
+SynapticsReadEvent(InputInfoPtr pInfo, struct CommData *comm,
+                   struct input_event *ev)
 {
     SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
     struct eventcomm_proto_data *proto_data = priv->proto_data;
     int rc;
     static struct timeval last_event_time;
 
-    rc = libevdev_next_event(proto_data->evdev, proto_data->read_flag, ev);
-    if (rc < 0) {
-        if (rc != -EAGAIN) {
-            LogMessageVerbSigSafe(X_ERROR, 0, "%s: Read error %d\n", pInfo->name,
-                    errno);
-        } else if (proto_data->read_flag == LIBEVDEV_READ_FLAG_SYNC) {
-            proto_data->read_flag = LIBEVDEV_READ_FLAG_NORMAL;
-            return SynapticsReadEvent(pInfo, ev);
-        }
+    /* resync in progress, libevdev hands out the state changes */
+    if (proto_data->read_flag == LIBEVDEV_READ_FLAG_SYNC) {
+        rc = libevdev_next_event(proto_data->evdev, LIBEVDEV_READ_FLAG_SYNC,
+                                 ev);
+        if (rc >= 0)
+            return TRUE;
 
-        return FALSE;
+        if (rc != -EAGAIN)
+            LogMessageVerbSigSafe(X_ERROR, 0, "%s: Read error %d\n",
+                                  pInfo->name, -rc);
+        proto_data->read_flag = LIBEVDEV_READ_FLAG_NORMAL;
     }
 
-    /* SYN_DROPPED received in normal mode. Create a normal EV_SYN
-       so we process what's in the queue atm, then ensure we sync
-       next time */
-    if (rc == LIBEVDEV_READ_STATUS_SYNC &&
-        proto_data->read_flag == LIBEVDEV_READ_FLAG_NORMAL) {
+    if (proto_data->events_pos == proto_data->events_len &&
+        !EventFillBuffer(pInfo, proto_data))
+        return FALSE;
+
+    *ev = proto_data->events[proto_data->events_pos++];
+
+    /* SYN_DROPPED received. The rest of the buffer is incomplete, throw it
+       away and have libevdev query the device. Create a normal EV_SYN so
+       we process what's in the frame atm, the resync events follow on the
+       next read. */
+    if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+        struct input_event dropped;
+
+        proto_data->events_pos = 0;
+        proto_data->events_len = 0;
+
+        EventUpdateLibevdevState(pInfo, comm);
+        libevdev_next_event(proto_data->evdev,
+                            LIBEVDEV_READ_FLAG_FORCE_SYNC, &dropped);
         proto_data->read_flag = LIBEVDEV_READ_FLAG_SYNC;
-        ev->type = EV_SYN;
+
         ev->code = SYN_REPORT;
         ev->value = 0;
         ev->time = last_event_time;
@@ -584,13 +704,7 @@ SynapticsReadEvent(InputInfoPtr pInfo, struct input_event *ev)
 static Bool
 EventTouchSlotPreviouslyOpen(SynapticsPrivate * priv, int slot)
 {
-    int i;
-
-    for (i = 0; i < priv->num_active_touches; i++)
-        if (priv->open_slots[i] == slot)
-            return TRUE;
-
-    return FALSE;
+    return (priv->open_slots & (1U << slot)) != 0;
 }
 
 static void
@@ -609,17 +723,26 @@ EventProcessTouchEvent(InputInfoPtr pInfo, struct SynapticsHwState *hw,
     else {
         int slot_index = proto_data->cur_slot;
 
-        if (slot_index < 0)
+        if (slot_index < 0 || slot_index >= priv->num_slots)
             return;
 
         if (hw->slot_state[slot_index] == SLOTSTATE_OPEN_EMPTY)
             hw->slot_state[slot_index] = SLOTSTATE_UPDATE;
         if (ev->code == ABS_MT_TRACKING_ID) {
+            proto_data->tracking_ids[slot_index] = ev->value;
             if (ev->value >= 0) {
+                const int *vals = LAST_MT_VALS(proto_data, priv, slot_index);
+                int map;
+
                 hw->slot_state[slot_index] = SLOTSTATE_OPEN;
                 proto_data->num_touches++;
-                valuator_mask_copy(hw->mt_mask[slot_index],
-                                   proto_data->last_mt_vals[slot_index]);
+                hw->slot_x[slot_index] = vals[0];
+                hw->slot_y[slot_index] = vals[1];
+                map = proto_data->axis_map[ABS_MT_PRESSURE - ABS_MT_TOUCH_MAJOR];
+                hw->slot_pressure[slot_index] = map >= 0 ? vals[map] : 0;
+                map = proto_data->axis_map[0];
+                hw->slot_touch_major[slot_index] = map >= 0 ? vals[map] : 0;
+                hw->dirty_slots |= 1U << slot_index;
             }
             else if (hw->slot_state[slot_index] != SLOTSTATE_EMPTY) {
                 hw->slot_state[slot_index] = SLOTSTATE_CLOSE;
@@ -635,11 +758,29 @@ EventProcessTouchEvent(InputInfoPtr pInfo, struct SynapticsHwState *hw,
             }
         }
         else {
-            ValuatorMask *mask = proto_data->last_mt_vals[slot_index];
+            int *vals = LAST_MT_VALS(proto_data, priv, slot_index);
             int map = proto_data->axis_map[ev->code - ABS_MT_TOUCH_MAJOR];
-            int last_val = valuator_mask_get(mask, map);
+            int last_val;
+
+            if (map < 0)
+                return;
+            last_val = vals[map];
 
-            valuator_mask_set(hw->mt_mask[slot_index], map, ev->value);
+            switch (ev->code) {
+            case ABS_MT_POSITION_X:
+                hw->slot_x[slot_index] = ev->value;
+                break;
+            case ABS_MT_POSITION_Y:
+                hw->slot_y[slot_index] = ev->value;
+                break;
+            case ABS_MT_PRESSURE:
+                hw->slot_pressure[slot_index] = ev->value;
+                break;
+            case ABS_MT_TOUCH_MAJOR:
+                hw->slot_touch_major[slot_index] = ev->value;
+                break;
+            }
+            hw->dirty_slots |= 1U << slot_index;
             if (EventTouchSlotPreviouslyOpen(priv, slot_index)) {
                 if (ev->code == ABS_MT_POSITION_X)
                     hw->cumulative_dx += ev->value - last_val;
@@ -653,7 +794,7 @@ EventProcessTouchEvent(InputInfoPtr pInfo, struct SynapticsHwState *hw,
                     hw->z = ev->value;
             }
 
-            valuator_mask_set(mask, map, ev->value);
+            vals[map] = ev->value;
         }
     }
 }
@@ -705,8 +846,6 @@ EventReadHwState(InputInfoPtr pInfo,
     struct eventcomm_proto_data *proto_data = priv->proto_data;
     Bool sync_cumulative = FALSE;
 
-    SynapticsResetTouchHwState(hw, FALSE);
-
     /* Reset cumulative values if buttons were not previously pressed and no
      * two-finger scrolling is ongoing, or no finger was previously present. */
     if (((!hw->left && !hw->right && !hw->middle) &&
@@ -717,7 +856,7 @@ EventReadHwState(InputInfoPtr pInfo,
         sync_cumulative = TRUE;
     }
 
-    while (SynapticsReadEvent(pInfo, &ev)) {
+    while (SynapticsReadEvent(pInfo, comm, &ev)) {
         switch (ev.type) {
         case EV_SYN:
             switch (ev.code) {
@@ -728,6 +867,9 @@ EventReadHwState(InputInfoPtr pInfo,
                 else
                     hw->millis = GetTimeInMillis();
                 SynapticsCopyHwState(hwRet, hw);
+                /* Reset once the frame is complete, a frame split across
+                 * reads must keep the slots it already changed. */
+                SynapticsResetTouchHwState(hw, FALSE);
                 return TRUE;
             }
             break;
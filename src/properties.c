@@ -93,8 +93,17 @@ Atom prop_area = 0;
 Atom prop_softbutton_areas = 0;
 Atom prop_secondary_softbutton_areas = 0;
 Atom prop_noise_cancellation = 0;
+Atom prop_three_finger_drag = 0;
+Atom prop_stage_timing = 0;
 Atom prop_product_id = 0;
 Atom prop_device_node = 0;
+Atom prop_report_rate = 0;
+Atom prop_timer_fires = 0;
+Atom prop_stage_latency = 0;
+Atom prop_state_trace = 0;
+
+/* Set while GetProperty refreshes a read-only property */
+static Bool updating_readonly = FALSE;
 
 static Atom
 InitTypedAtom(DeviceIntPtr dev, char *name, Atom type, int format, int nvalues,
@@ -195,6 +204,20 @@ InitSoftButtonProperty(InputInfoPtr pInfo)
             InitAtom(pInfo->dev, SYNAPTICS_PROP_SECONDARY_SOFTBUTTON_AREAS, 32, 8, values);
 }
 
+/* Too many values for InitTypedAtom, the histograms are passed as they are */
+static void
+InitStageLatencyProperty(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    const char *name = SYNAPTICS_PROP_STAGE_LATENCY;
+
+    prop_stage_latency = MakeAtom(name, strlen(name), TRUE);
+    XIChangeDeviceProperty(pInfo->dev, prop_stage_latency, XA_CARDINAL, 32,
+                           PropModeReplace, STAGE_COUNT * STAGE_BUCKETS,
+                           priv->stage_hist, FALSE);
+    XISetDevicePropertyDeletable(pInfo->dev, prop_stage_latency, FALSE);
+}
+
 void
 InitDeviceProperties(InputInfoPtr pInfo)
 {
@@ -382,6 +405,31 @@ InitDeviceProperties(InputInfoPtr pInfo)
                                        SYNAPTICS_PROP_NOISE_CANCELLATION, 32, 2,
                                        values);
 
+    values[0] = para->three_finger_drag_delay;
+    values[1] = para->three_finger_drag_commit_move;
+    prop_three_finger_drag =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_THREE_FINGER_DRAG, 32, 2, values);
+
+    values[0] = 0;
+    prop_report_rate =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_REPORT_RATE, 32, 1, values);
+
+    values[0] = 0;
+    values[1] = 0;
+    prop_timer_fires =
+        InitTypedAtom(pInfo->dev, SYNAPTICS_PROP_TIMER_FIRES, XA_CARDINAL,
+                      32, 2, values);
+
+    prop_stage_timing =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_STAGE_TIMING, 8, 1,
+                 &para->stage_timing);
+
+    InitStageLatencyProperty(pInfo);
+
+    prop_state_trace =
+        InitTypedAtom(pInfo->dev, SYNAPTICS_PROP_STATE_TRACE, XA_CARDINAL,
+                      32, 0, values);
+
     /* only init product_id property if we actually know them */
     if (priv->id_vendor || priv->id_product) {
         values[0] = priv->id_vendor;
@@ -815,8 +863,58 @@ SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
         para->hyst_x = hyst[0];
         para->hyst_y = hyst[1];
     }
+    else if (property == prop_three_finger_drag) {
+        INT32 *values;
+
+        if (prop->size != 2 || prop->format != 32 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        values = (INT32 *) prop->data;
+        if (values[0] < 0 || values[1] < 0)
+            return BadValue;
+        para->three_finger_drag_delay = values[0];
+        para->three_finger_drag_commit_move = values[1];
+    }
+    else if (property == prop_stage_timing) {
+        BOOL on;
+
+        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        on = *(BOOL *) prop->data;
+        /* stages already running when timing starts have no start time */
+        if (!checkonly && on && !para->stage_timing)
+            memset(priv->stage_start, 0, sizeof(priv->stage_start));
+        para->stage_timing = on;
+    }
     else if (property == prop_product_id || property == prop_device_node)
         return BadValue;        /* read-only */
+    else if (property == prop_report_rate || property == prop_timer_fires ||
+             property == prop_state_trace) {
+        /* read-only, updated by GetProperty, nothing is derived from it */
+        return updating_readonly ? Success : BadValue;
+    }
+    else if (property == prop_stage_latency) {
+        CARD32 *counts;
+        int i;
+
+        /* read-only, updated by GetProperty, but zeros reset it */
+        if (updating_readonly)
+            return Success;
+
+        if (prop->size != STAGE_COUNT * STAGE_BUCKETS || prop->format != 32 ||
+            prop->type != XA_CARDINAL)
+            return BadMatch;
+
+        counts = (CARD32 *) prop->data;
+        for (i = 0; i < prop->size; i++)
+            if (counts[i] != 0)
+                return BadValue;
+
+        if (!checkonly)
+            memset(priv->stage_hist, 0, sizeof(priv->stage_hist));
+        return Success;
+    }
     else { /* unknown property */
         if (strcmp(SYNAPTICS_PROP_SOFTBUTTON_AREAS, NameForAtom(property)) == 0)
         {
@@ -828,5 +926,78 @@ SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
         }
     }
 
+    if (!checkonly)
+        SynapticsUpdateDerivedParameters(priv);
+
+    return Success;
+}
+
+int
+GetProperty(DeviceIntPtr dev, Atom property)
+{
+    InputInfoPtr pInfo = dev->public.devicePrivate;
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+
+    if (property == prop_report_rate) {
+        int interval = priv->report_interval;
+        int rate = interval ? (1000000 + interval / 2) / interval : 0;
+
+        updating_readonly = TRUE;
+        XIChangeDeviceProperty(dev, property, XA_INTEGER, 32,
+                               PropModeReplace, 1, &rate, FALSE);
+        updating_readonly = FALSE;
+    }
+    else if (property == prop_timer_fires) {
+        CARD32 fires[2];
+
+        fires[0] = priv->timer_fires;
+        fires[1] = priv->spurious_timer_fires;
+
+        updating_readonly = TRUE;
+        XIChangeDeviceProperty(dev, property, XA_CARDINAL, 32,
+                               PropModeReplace, 2, fires, FALSE);
+        updating_readonly = FALSE;
+    }
+    else if (property == prop_stage_latency) {
+        updating_readonly = TRUE;
+        XIChangeDeviceProperty(dev, property, XA_CARDINAL, 32,
+                               PropModeReplace, STAGE_COUNT * STAGE_BUCKETS,
+                               priv->stage_hist, FALSE);
+        updating_readonly = FALSE;
+    }
+    else if (property == prop_state_trace) {
+        CARD32 records[2 * SYNAPTICS_TRACE_SIZE];
+        uint32_t head = __atomic_load_n(&priv->trace_head, __ATOMIC_ACQUIRE);
+        uint32_t n = head < SYNAPTICS_TRACE_SIZE ? head : SYNAPTICS_TRACE_SIZE;
+        uint32_t i;
+        int lapped;
+
+        /* oldest first */
+        for (i = 0; i < n; i++) {
+            const SynapticsTraceRec *rec =
+                &priv->trace[(head - n + i) % SYNAPTICS_TRACE_SIZE];
+
+            records[2 * i] = rec->millis;
+            records[2 * i + 1] = rec->state;
+        }
+
+        /* The input thread doesn't wait for us. Drop the oldest records if
+         * it overwrote them while they were copied, counting the one it may
+         * be writing now. */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        lapped = (int) (__atomic_load_n(&priv->trace_head, __ATOMIC_RELAXED) +
+                        1 - SYNAPTICS_TRACE_SIZE - (head - n));
+        if (lapped < 0)
+            lapped = 0;
+        if (lapped > (int) n)
+            lapped = n;
+
+        updating_readonly = TRUE;
+        XIChangeDeviceProperty(dev, property, XA_CARDINAL, 32,
+                               PropModeReplace, 2 * (n - lapped),
+                               records + 2 * lapped, FALSE);
+        updating_readonly = FALSE;
+    }
+
     return Success;
 }
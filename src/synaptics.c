@@ -60,11 +60,13 @@
 #endif
 
 #include <xorg-server.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <misc.h>
 #include <xf86.h>
 #include <math.h>
 #include <stdio.h>
+#include <time.h>
 #include <xf86_OSproc.h>
 #include <xf86Xinput.h>
 #include <exevents.h>
@@ -76,6 +78,7 @@
 
 #include "synapticsstr.h"
 #include "synaptics-properties.h"
+#include "tapndrag.h"
 
 enum EdgeType {
     NO_EDGE = 0,
@@ -101,9 +104,24 @@ enum EdgeType {
  *
  * We use this to call back at a constant rate to at least produce the
  * illusion of smooth motion.  It works a lot better than you'd expect.
+ *
+ * Pads range from 40 Hz to 1 kHz though, so once the report rate has been
+ * measured the timer follows that instead, see poll_delay().
 */
 #define POLL_MS 14
 
+/* Shortest period of the synthetic motion timer. Fast pads report far
+ * more often than a screen refreshes, and the kernel leaves out the frames
+ * of a finger at rest, so following their rate all the way down would
+ * mostly wake the server up for nothing. */
+#define POLL_MIN_MS 8
+
+/* Longer intervals between reports are breaks in the input, not a slow pad */
+#define REPORT_GAP_MS 50
+
+/* Returned by HandleState and its helpers when nothing needs the timer */
+#define NO_DEADLINE 1000000000
+
 #define MAX(a, b) (((a)>(b))?(a):(b))
 #define MIN(a, b) (((a)<(b))?(a):(b))
 #define TIME_DIFF(a, b) ((int)((a)-(b)))
@@ -116,6 +134,63 @@ enum EdgeType {
 
 #define INPUT_BUFFER_SIZE 200
 
+static inline CARD64
+stage_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (CARD64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Nothing reads the clock unless StageTiming is on */
+static inline void
+stage_begin(SynapticsPrivate * priv, enum SynapticsStage stage)
+{
+    if (priv->synpara.stage_timing)
+        priv->stage_start[stage] = stage_clock();
+}
+
+/*
+ * Count the time since stage_begin() in the stage's histogram. A stage that
+ * began before StageTiming was turned on has no start and isn't counted.
+ */
+static inline void
+stage_end(SynapticsPrivate * priv, enum SynapticsStage stage)
+{
+    CARD64 ns;
+    int bucket = 0;
+
+    if (!priv->synpara.stage_timing || !priv->stage_start[stage])
+        return;
+
+    ns = stage_clock() - priv->stage_start[stage];
+
+    while (ns >= STAGE_BUCKET_MIN_NS && bucket < STAGE_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+    priv->stage_hist[stage][bucket]++;
+}
+
+/*
+ * Hooks around the stages of input processing, they expect priv in scope.
+ * bench/synbench.c defines these before including this file to add its own
+ * timing.
+ */
+#ifndef STAGE_BEGIN
+#define STAGE_BEGIN(stage) stage_begin(priv, stage)
+#define STAGE_END(stage) stage_end(priv, stage)
+#endif
+
+/*
+ * Fails to compile if the per-frame part of SynapticsPrivateRec, everything
+ * a frame writes or reads, outgrows SYNAPTICS_HOT_BYTES. Fields that aren't
+ * needed for every frame belong after device.
+ */
+typedef char SynapticsHotStateCheck[offsetof(SynapticsPrivate, device) <=
+                                    SYNAPTICS_HOT_BYTES ? 1 : -1];
+
 /*****************************************************************************
  * Forward declaration
  ****************************************************************************/
@@ -125,6 +200,12 @@ static Bool DeviceControl(DeviceIntPtr, int);
 static void ReadInput(InputInfoPtr);
 static int HandleState(InputInfoPtr, struct SynapticsHwState *, CARD32 now,
                        Bool from_timer);
+static int HandleCoasting(SynapticsPrivate * priv, CARD32 now);
+static Bool scrolling_off(const SynapticsPrivate * priv);
+static void stop_coasting(SynapticsPrivate * priv);
+static Bool three_finger_drag_moving(SynapticsPrivate * priv,
+                                     const struct SynapticsHwState *hw);
+static void post_scroll_events(const InputInfoPtr pInfo);
 static int ControlProc(InputInfoPtr, xDeviceCtl *);
 static int SwitchMode(ClientPtr, DeviceIntPtr, int);
 static int DeviceInit(DeviceIntPtr);
@@ -143,6 +224,9 @@ static void SanitizeDimensions(InputInfoPtr pInfo);
 void InitDeviceProperties(InputInfoPtr pInfo);
 int SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
                 BOOL checkonly);
+int GetProperty(DeviceIntPtr dev, Atom property);
+
+int synaptics_log_verbosity = 0;
 
 const static struct {
     const char *name;
@@ -746,6 +830,16 @@ set_default_parameters(InputInfoPtr pInfo)
     pars->min_speed = xf86SetRealOption(opts, "MinSpeed", 0.4);
     pars->max_speed = xf86SetRealOption(opts, "MaxSpeed", 0.7);
     pars->accl = xf86SetRealOption(opts, "AccelFactor", accelFactor);
+    pars->predict_time = xf86SetIntOption(opts, "MotionPredictionTime", 0);
+    pars->velocity_estimator =
+        xf86SetIntOption(opts, "VelocityEstimator", VELOCITY_SERVER);
+    if (pars->velocity_estimator != VELOCITY_SERVER &&
+        pars->velocity_estimator != VELOCITY_HISTORY) {
+        xf86IDrvMsg(pInfo, X_ERROR,
+                    "Invalid VelocityEstimator %d, using %d instead.\n",
+                    pars->velocity_estimator, VELOCITY_SERVER);
+        pars->velocity_estimator = VELOCITY_SERVER;
+    }
     pars->scroll_dist_circ = xf86SetRealOption(opts, "CircScrollDelta", 0.1);
     pars->coasting_speed = xf86SetRealOption(opts, "CoastingSpeed", 20.0);
     pars->coasting_friction = xf86SetRealOption(opts, "CoastingFriction", 50);
@@ -765,12 +859,17 @@ set_default_parameters(InputInfoPtr pInfo)
 
     pars->tap_and_drag_gesture =
         xf86SetBoolOption(opts, "TapAndDragGesture", TRUE);
+    pars->tap_and_drag_rollback =
+        xf86SetBoolOption(opts, "TapAndDragRollback", FALSE);
     pars->resolution_horiz =
         xf86SetIntOption(opts, "HorizResolution", horizResolution);
     pars->resolution_vert =
         xf86SetIntOption(opts, "VertResolution", vertResolution);
 	pars->three_finger_drag_delay = 
 		xf86SetIntOption(opts, "ThreeFingerDragDelay", 170);
+    pars->three_finger_drag_commit_move =
+        xf86SetIntOption(opts, "ThreeFingerDragCommitMove", 0);
+    pars->stage_timing = xf86SetBoolOption(opts, "StageTiming", FALSE);
     if (pars->resolution_horiz <= 0) {
         xf86IDrvMsg(pInfo, X_ERROR,
                     "Invalid X resolution, using 1 instead.\n");
@@ -812,6 +911,63 @@ set_default_parameters(InputInfoPtr pInfo)
     set_primary_softbutton_areas_option(pInfo);
     if (pars->has_secondary_buttons)
         set_secondary_softbutton_areas_option(pInfo);
+
+    SynapticsUpdateDerivedParameters(priv);
+}
+
+/*
+ * Rebuild priv->derived from the parameters and device dimensions. Must be
+ * called after changing either.
+ */
+void
+SynapticsUpdateDerivedParameters(SynapticsPrivate * priv)
+{
+    SynapticsParameters *para = &priv->synpara;
+    SynapticsDerivedRec *derived = &priv->derived;
+    int i;
+
+    derived->edge_center_x = (para->left_edge + para->right_edge) / 2.0;
+    derived->edge_center_y = (para->top_edge + para->bottom_edge) / 2.0;
+    derived->edge_radius_x = para->right_edge - derived->edge_center_x;
+    derived->edge_radius_y = para->bottom_edge - derived->edge_center_y;
+
+    derived->inv_resolution_horiz = 1.0 / para->resolution_horiz;
+    derived->inv_resolution_vert = 1.0 / para->resolution_vert;
+    derived->max_delta_sq = (double) para->maxDeltaMM * para->maxDeltaMM;
+
+    /* FIXME: fingers closer together than 30% of touchpad width, but
+     * really, this should be dependent on the touchpad size. Also,
+     * you'll need to find a touchpad that doesn't lie about it's
+     * size. Good luck. */
+    derived->clickfinger_dist_x = (priv->maxx - priv->minx) * .3;
+    derived->clickfinger_dist_y = (priv->maxy - priv->miny) * .3;
+
+    for (i = 0; i < 4; i++) {
+        const int *area = para->softbutton_areas[i];
+
+        derived->button_area[i].valid =
+            area[LEFT] || area[RIGHT] || area[TOP] || area[BOTTOM];
+        derived->button_area[i].left = area[LEFT] ? area[LEFT] : INT_MIN;
+        derived->button_area[i].right = area[RIGHT] ? area[RIGHT] : INT_MAX;
+        derived->button_area[i].top = area[TOP] ? area[TOP] : INT_MIN;
+        derived->button_area[i].bottom = area[BOTTOM] ? area[BOTTOM] : INT_MAX;
+    }
+
+    /* We don't have a left button area, so a row only has a y range */
+    for (i = 0; i < 2; i++) {
+        const int *right = para->softbutton_areas[2 * i];
+        const int *middle = para->softbutton_areas[2 * i + 1];
+        Bool right_valid = right[TOP] || right[BOTTOM];
+        Bool middle_valid = middle[TOP] || middle[BOTTOM];
+        const int *area = right_valid ? right : middle;
+
+        /* Both buttons must be horizontally aligned */
+        derived->button_row[i].valid = (right_valid || middle_valid) &&
+            !(right_valid && middle_valid &&
+              (right[TOP] != middle[TOP] || right[BOTTOM] != middle[BOTTOM]));
+        derived->button_row[i].top = area[TOP] ? area[TOP] : INT_MIN;
+        derived->button_row[i].bottom = area[BOTTOM] ? area[BOTTOM] : INT_MAX;
+    }
 }
 
 static double
@@ -828,8 +984,13 @@ SynapticsAccelerationProfile(DeviceIntPtr dev,
     /*
      * synaptics accel was originally base on device coordinate based
      * velocity, which we recover this way so para->accl retains its scale.
+     * The driver's own estimate is in units/ms, the server's in units per
+     * corr_mul ms.
      */
-    velocity /= vel->const_acceleration;
+    if (para->velocity_estimator == VELOCITY_HISTORY)
+        velocity = priv->finger_velocity * vel->corr_mul;
+    else
+        velocity /= vel->const_acceleration;
 
     /* speed up linear with finger velocity */
     accelfct = velocity * para->accl;
@@ -867,6 +1028,14 @@ static int
 SynapticsPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
 {
     SynapticsPrivate *priv;
+    const char *error;
+
+    synaptics_log_verbosity = MAX(xf86GetVerbosity(), xf86GetLogVerbosity());
+
+    if (!TapTableInit(&error)) {
+        xf86IDrvMsg(pInfo, X_ERROR, "bad tap state table: %s\n", error);
+        return BadImplementation;
+    }
 
     /* allocate memory for SynapticsPrivateRec */
     priv = calloc(1, sizeof(SynapticsPrivate));
@@ -969,8 +1138,10 @@ SynapticsUnInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
         free(priv->proto_data);
     if (priv && priv->scroll_events_mask)
         valuator_mask_free(&priv->scroll_events_mask);
-    if (priv && priv->open_slots)
-        free(priv->open_slots);
+    if (priv && priv->motion_events_mask)
+        valuator_mask_free(&priv->motion_events_mask);
+    if (priv && priv->slot_pos)
+        free(priv->slot_pos);
     free(pInfo->private);
     pInfo->private = NULL;
     xf86DeleteInput(pInfo, 0);
@@ -1055,8 +1226,6 @@ error:
 static void
 SynapticsReset(SynapticsPrivate * priv)
 {
-    int i;
-
     SynapticsResetHwState(priv->hwState);
     SynapticsResetHwState(priv->local_hw_state);
     SynapticsResetHwState(priv->comm.hwState);
@@ -1066,6 +1235,7 @@ SynapticsReset(SynapticsPrivate * priv)
     priv->hyst_center_y = 0;
     memset(&priv->scroll, 0, sizeof(priv->scroll));
     priv->count_packet_finger = 0;
+    priv->finger_velocity = 0;
     priv->finger_state = FS_UNTOUCHED;
     priv->last_motion_millis = 0;
     priv->clickpad_click_millis = 0;
@@ -1082,13 +1252,11 @@ SynapticsReset(SynapticsPrivate * priv)
     priv->circ_scroll_vert = FALSE;
     priv->mid_emu_state = MBE_OFF;
     priv->nextRepeat = 0;
+    priv->pending_deadlines = 0;
     priv->lastButtons = 0;
     priv->prev_z = 0;
     priv->prevFingers = 0;
-    priv->num_active_touches = 0;
-
-    for (i = 0; i < priv->num_slots; i++)
-        priv->open_slots[i] = -1;
+    priv->open_slots = 0;
 
 	priv->three_finger_drag_on = FALSE;
 	priv->has_seen_two_finger_scroll = FALSE;
@@ -1201,11 +1369,17 @@ DeviceInitTouch(DeviceIntPtr dev, Atom *axes_labels)
 
     priv->num_slots =
         priv->max_touches ? priv->max_touches : SYNAPTICS_MAX_TOUCHES;
+    if (priv->num_slots > SYNAPTICS_MAX_SLOTS) {
+        xf86IDrvMsg(pInfo, X_WARNING,
+                    "device has %d touch slots, only using the first %d\n",
+                    priv->num_slots, SYNAPTICS_MAX_SLOTS);
+        priv->num_slots = SYNAPTICS_MAX_SLOTS;
+    }
 
-    priv->open_slots = malloc(priv->num_slots * sizeof(int));
-    if (!priv->open_slots) {
+    priv->slot_pos = calloc(priv->num_slots, sizeof(SynapticsSlotPosRec));
+    if (!priv->slot_pos) {
         xf86IDrvMsg(pInfo, X_ERROR,
-                    "failed to allocate open touch slots array\n");
+                    "failed to allocate touch slot positions array\n");
         priv->has_touch = 0;
         priv->num_slots = 0;
     }
@@ -1335,6 +1509,11 @@ DeviceInit(DeviceIntPtr dev)
         free(axes_labels);
         return !Success;
     }
+    priv->motion_events_mask = valuator_mask_new(2);
+    if (!priv->motion_events_mask) {
+        free(axes_labels);
+        return !Success;
+    }
 
     SetScrollValuator(dev, priv->scroll_axis_horiz, SCROLL_TYPE_HORIZONTAL,
                       priv->synpara.scroll_dist_horiz, 0);
@@ -1356,7 +1535,7 @@ DeviceInit(DeviceIntPtr dev)
     priv->comm.hwState = SynapticsHwStateAlloc(priv);
 
     InitDeviceProperties(pInfo);
-    XIRegisterPropertyHandler(pInfo->dev, SetProperty, NULL, NULL);
+    XIRegisterPropertyHandler(pInfo->dev, SetProperty, GetProperty, NULL);
 
     SynapticsReset(priv);
 
@@ -1365,7 +1544,7 @@ DeviceInit(DeviceIntPtr dev)
  fail:
     free(priv->local_hw_state);
     free(priv->hwState);
-    free(priv->open_slots);
+    free(priv->slot_pos);
     return !Success;
 }
 
@@ -1378,16 +1557,11 @@ static void
 relative_coords(SynapticsPrivate * priv, int x, int y,
                 double *relX, double *relY)
 {
-    int minX = priv->synpara.left_edge;
-    int maxX = priv->synpara.right_edge;
-    int minY = priv->synpara.top_edge;
-    int maxY = priv->synpara.bottom_edge;
-    double xCenter = (minX + maxX) / 2.0;
-    double yCenter = (minY + maxY) / 2.0;
+    const SynapticsDerivedRec *derived = &priv->derived;
 
-    if ((maxX - xCenter > 0) && (maxY - yCenter > 0)) {
-        *relX = (x - xCenter) / (maxX - xCenter);
-        *relY = (y - yCenter) / (maxY - yCenter);
+    if (derived->edge_radius_x > 0 && derived->edge_radius_y > 0) {
+        *relX = (x - derived->edge_center_x) / derived->edge_radius_x;
+        *relY = (y - derived->edge_center_y) / derived->edge_radius_y;
     }
     else {
         *relX = 0;
@@ -1399,10 +1573,8 @@ relative_coords(SynapticsPrivate * priv, int x, int y,
 static double
 angle(SynapticsPrivate * priv, int x, int y)
 {
-    double xCenter = (priv->synpara.left_edge + priv->synpara.right_edge) / 2.0;
-    double yCenter = (priv->synpara.top_edge + priv->synpara.bottom_edge) / 2.0;
-
-    return atan2(-(y - yCenter), x - xCenter);
+    return atan2(-(y - priv->derived.edge_center_y),
+                 x - priv->derived.edge_center_x);
 }
 
 /* return angle difference */
@@ -1496,107 +1668,131 @@ is_inside_active_area(SynapticsPrivate * priv, int x, int y)
 }
 
 static Bool
-is_inside_button_area(SynapticsParameters * para, int which, int x, int y)
+is_inside_button_area(const SynapticsDerivedRec * derived, int which,
+                      int x, int y)
 {
-    Bool inside_area = TRUE;
-
-    if (para->softbutton_areas[which][LEFT] == 0 &&
-        para->softbutton_areas[which][RIGHT] == 0 &&
-        para->softbutton_areas[which][TOP] == 0 &&
-        para->softbutton_areas[which][BOTTOM] == 0)
-        return FALSE;
-
-    if (para->softbutton_areas[which][LEFT] &&
-        x < para->softbutton_areas[which][LEFT])
-        inside_area = FALSE;
-    else if (para->softbutton_areas[which][RIGHT] &&
-             x > para->softbutton_areas[which][RIGHT])
-        inside_area = FALSE;
-    else if (para->softbutton_areas[which][TOP] &&
-             y < para->softbutton_areas[which][TOP])
-        inside_area = FALSE;
-    else if (para->softbutton_areas[which][BOTTOM] &&
-             y > para->softbutton_areas[which][BOTTOM])
-        inside_area = FALSE;
-
-    return inside_area;
+    return derived->button_area[which].valid &&
+        x >= derived->button_area[which].left &&
+        x <= derived->button_area[which].right &&
+        y >= derived->button_area[which].top &&
+        y <= derived->button_area[which].bottom;
 }
 
 static Bool
-is_inside_rightbutton_area(SynapticsParameters * para, int x, int y)
+is_inside_rightbutton_area(const SynapticsDerivedRec * derived, int x, int y)
 {
-    return is_inside_button_area(para, BOTTOM_RIGHT_BUTTON_AREA, x, y);
+    return is_inside_button_area(derived, BOTTOM_RIGHT_BUTTON_AREA, x, y);
 }
 
 static Bool
-is_inside_middlebutton_area(SynapticsParameters * para, int x, int y)
+is_inside_middlebutton_area(const SynapticsDerivedRec * derived, int x, int y)
 {
-    return is_inside_button_area(para, BOTTOM_MIDDLE_BUTTON_AREA, x, y);
+    return is_inside_button_area(derived, BOTTOM_MIDDLE_BUTTON_AREA, x, y);
 }
 
 static Bool
-is_inside_sec_rightbutton_area(SynapticsParameters * para, int x, int y)
+is_inside_sec_rightbutton_area(const SynapticsDerivedRec * derived,
+                               int x, int y)
 {
-    return is_inside_button_area(para, TOP_RIGHT_BUTTON_AREA, x, y);
+    return is_inside_button_area(derived, TOP_RIGHT_BUTTON_AREA, x, y);
 }
 
 static Bool
-is_inside_sec_middlebutton_area(SynapticsParameters * para, int x, int y)
+is_inside_sec_middlebutton_area(const SynapticsDerivedRec * derived,
+                                int x, int y)
 {
-    return is_inside_button_area(para, TOP_MIDDLE_BUTTON_AREA, x, y);
+    return is_inside_button_area(derived, TOP_MIDDLE_BUTTON_AREA, x, y);
 }
 
 static Bool
-is_inside_top_or_bottom_button_area(SynapticsParameters * para, int offset,
-                                    int x, int y)
+is_inside_top_or_bottom_button_area(const SynapticsDerivedRec * derived,
+                                    int offset, int x, int y)
 {
-    Bool inside_area = TRUE;
-    Bool right_valid, middle_valid;
-    int top, bottom;
+    int row = offset / 2;
 
-    /* We don't have a left button area, so we only check the y axis */
-    right_valid = para->softbutton_areas[offset][TOP] ||
-                  para->softbutton_areas[offset][BOTTOM];
-    middle_valid = para->softbutton_areas[offset + 1][TOP] ||
-                   para->softbutton_areas[offset + 1][BOTTOM];
+    return derived->button_row[row].valid &&
+        y >= derived->button_row[row].top &&
+        y <= derived->button_row[row].bottom;
+}
 
-    if (!right_valid && !middle_valid)
-        return FALSE;
+static enum SoftButtonAreas
+current_button_area(const SynapticsDerivedRec * derived, int x, int y)
+{
+    if (is_inside_top_or_bottom_button_area(derived, BOTTOM_BUTTON_AREA, x, y))
+        return BOTTOM_BUTTON_AREA;
+    else if (is_inside_top_or_bottom_button_area(derived, TOP_BUTTON_AREA, x, y))
+        return TOP_BUTTON_AREA;
+    else
+        return NO_BUTTON_AREA;
+}
 
-    /* Check both buttons are horizontally aligned */
-    if (right_valid && middle_valid && (
-            para->softbutton_areas[offset][TOP] !=
-                para->softbutton_areas[offset + 1][TOP] ||
-            para->softbutton_areas[offset][BOTTOM] !=
-                para->softbutton_areas[offset + 1][BOTTOM]))
-        return FALSE;
+static CARD32 timerFunc(OsTimerPtr timer, CARD32 now, pointer arg);
 
-    if (right_valid) {
-        top    = para->softbutton_areas[offset][TOP];
-        bottom = para->softbutton_areas[offset][BOTTOM];
+/*
+ * The deadline queue. Every part of HandleState that wants to be called
+ * back registers its timeout here, replacing the one it set before. The
+ * timer is armed for the earliest one, and when it fires only what has
+ * expired needs to run.
+ */
+static void
+SetDeadline(SynapticsPrivate * priv, enum SynapticsDeadline which,
+            CARD32 now, int delay)
+{
+    if (delay <= 0 || delay >= NO_DEADLINE) {
+        priv->pending_deadlines &= ~(1U << which);
+        return;
     }
-    else {
-        top    = para->softbutton_areas[offset + 1][TOP];
-        bottom = para->softbutton_areas[offset + 1][BOTTOM];
+
+    priv->deadlines[which] = now + delay;
+    priv->pending_deadlines |= 1U << which;
+}
+
+/* Time until the earliest pending deadline, or NO_DEADLINE */
+static int
+NextDeadline(const SynapticsPrivate * priv, CARD32 now)
+{
+    int delay = NO_DEADLINE;
+    int i;
+
+    for (i = 0; i < DEADLINE_COUNT; i++) {
+        if (priv->pending_deadlines & (1U << i))
+            delay = MIN(delay, MAX(TIME_DIFF(priv->deadlines[i], now), 1));
     }
 
-    if (top && y < top)
-        inside_area = FALSE;
-    else if (bottom && y > bottom)
-        inside_area = FALSE;
+    return delay;
+}
 
-    return inside_area;
+/* Mask of the pending deadlines that have expired by now */
+static unsigned int
+ExpiredDeadlines(const SynapticsPrivate * priv, CARD32 now)
+{
+    unsigned int expired = 0;
+    int i;
+
+    for (i = 0; i < DEADLINE_COUNT; i++) {
+        if ((priv->pending_deadlines & (1U << i)) &&
+            TIME_DIFF(priv->deadlines[i], now) <= 0)
+            expired |= 1U << i;
+    }
+
+    return expired;
 }
 
-static enum SoftButtonAreas
-current_button_area(SynapticsParameters * para, int x, int y)
+/*
+ * Arm the timer for the deadline returned by HandleState. If there is
+ * none, i.e. no tap timeout, button emulation, scroll button repeat,
+ * coasting or synthetic motion is pending, the timer is stopped so an idle
+ * pad doesn't wake up the server.
+ */
+static void
+SynapticsSetTimer(InputInfoPtr pInfo, int delay)
 {
-    if (is_inside_top_or_bottom_button_area(para, BOTTOM_BUTTON_AREA, x, y))
-        return BOTTOM_BUTTON_AREA;
-    else if (is_inside_top_or_bottom_button_area(para, TOP_BUTTON_AREA, x, y))
-        return TOP_BUTTON_AREA;
+    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+
+    if (delay >= NO_DEADLINE)
+        TimerCancel(priv->timer);
     else
-        return NO_BUTTON_AREA;
+        priv->timer = TimerSet(priv->timer, 0, delay, timerFunc, pInfo);
 }
 
 static CARD32
@@ -1604,7 +1800,11 @@ timerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
 {
     InputInfoPtr pInfo = arg;
     SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
-    struct SynapticsHwState *hw = priv->local_hw_state;
+    struct SynapticsHwState hw;
+    enum TapState tap_state = priv->tap_state;
+    enum MovingState moving_state = priv->moving_state;
+    enum MidButtonEmulation mid_emu_state = priv->mid_emu_state;
+    CARD32 millis;
     int delay;
 #if !HAVE_THREADED_INPUT
     int sigstate = xf86BlockSIGIO();
@@ -1612,13 +1812,52 @@ timerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
     input_lock();
 #endif
 
+    STAGE_BEGIN(STAGE_TIMER);
+
     priv->hwState->millis += now - priv->timer_time;
-    SynapticsCopyHwState(hw, priv->hwState);
-    SynapticsResetTouchHwState(hw, FALSE);
-    delay = HandleState(pInfo, hw, hw->millis, TRUE);
+    millis = priv->hwState->millis;
+
+    if (ExpiredDeadlines(priv, millis) == (1U << DEADLINE_COAST)) {
+        /* Only coasting is due. It doesn't depend on the hardware state,
+         * so there's no need to run all of HandleState for it. It may
+         * have to stop though, as HandleScrolling would. */
+        priv->events_posted = FALSE;
+        if (scrolling_off(priv)) {
+            stop_coasting(priv);
+            SetDeadline(priv, DEADLINE_COAST, millis, NO_DEADLINE);
+        }
+        else
+            SetDeadline(priv, DEADLINE_COAST, millis,
+                        HandleCoasting(priv, millis));
+        if (priv->scroll.delta_x != 0.0 || priv->scroll.delta_y != 0.0) {
+            post_scroll_events(pInfo);
+            priv->scroll.last_millis = millis;
+            priv->events_posted = TRUE;
+        }
+        delay = NextDeadline(priv, millis);
+    }
+    else {
+        /* HandleState changes the buttons and coordinates it is given, but
+         * leaves the touches alone when called from the timer. So only the
+         * former are copied, the touch masks and slot states are those of
+         * the last frame. */
+        hw = *priv->hwState;
+        delay = HandleState(pInfo, &hw, millis, TRUE);
+    }
+
+    /* a wakeup that neither posted anything nor moved a state machine on
+     * was not needed */
+    priv->timer_fires++;
+    if (!priv->events_posted && priv->tap_state == tap_state &&
+        priv->moving_state == moving_state &&
+        priv->mid_emu_state == mid_emu_state &&
+        !priv->scroll.coast_speed_x && !priv->scroll.coast_speed_y)
+        priv->spurious_timer_fires++;
 
     priv->timer_time = now;
-    priv->timer = TimerSet(priv->timer, 0, delay, timerFunc, pInfo);
+    SynapticsSetTimer(pInfo, delay);
+
+    STAGE_END(STAGE_TIMER);
 
 #if !HAVE_THREADED_INPUT
     xf86UnblockSIGIO(sigstate);
@@ -1640,11 +1879,63 @@ clamp(int val, int min, int max)
         return max;
 }
 
+/*
+ * Keep a running average of the time between two hardware reports. The
+ * kernel drops frames that don't change anything, so intervals well above
+ * the average are taken as missed reports and not counted, unless there
+ * are enough of them in a row that the average must be off.
+ */
+static void
+UpdateReportInterval(SynapticsPrivate * priv, CARD32 millis)
+{
+    int interval = TIME_DIFF(millis, priv->last_report_millis) * 1000;
+
+    priv->last_report_millis = millis;
+
+    /* frames read together without a kernel timestamp share a time */
+    if (interval <= 0 || interval > REPORT_GAP_MS * 1000)
+        return;
+
+    if (!priv->report_interval) {
+        priv->report_interval = interval;
+        return;
+    }
+
+    if (interval > priv->report_interval * 3 / 2 &&
+        ++priv->report_outliers < 8)
+        return;
+
+    priv->report_outliers = 0;
+    priv->report_interval += (interval - priv->report_interval) / 8;
+}
+
+/*
+ * Period of the timer producing synthetic motion: a bit longer than the
+ * time between two reports so that it only fires when a report is late,
+ * see the comment above POLL_MS, but no shorter than POLL_MIN_MS.
+ */
+static int
+poll_delay(const SynapticsPrivate * priv)
+{
+    if (!priv->report_interval)
+        return POLL_MS;
+
+    return MAX((priv->report_interval + 999) / 1000 + 1, POLL_MIN_MS);
+}
+
 static Bool
 SynapticsGetHwState(InputInfoPtr pInfo, SynapticsPrivate * priv,
                     struct SynapticsHwState *hw)
 {
-    return priv->proto_ops->ReadHwState(pInfo, &priv->comm, hw);
+    Bool ret;
+
+    STAGE_BEGIN(STAGE_HW);
+    ret = priv->proto_ops->ReadHwState(pInfo, &priv->comm, hw);
+    /* the read that finds no complete frame isn't counted */
+    if (ret)
+        STAGE_END(STAGE_HW);
+
+    return ret;
 }
 
 /*
@@ -1658,9 +1949,12 @@ ReadInput(InputInfoPtr pInfo)
     int delay = 0;
     Bool newDelay = FALSE;
 
+    STAGE_BEGIN(STAGE_READ);
     SynapticsResetTouchHwState(hw, FALSE);
 
     while (SynapticsGetHwState(pInfo, priv, hw)) {
+        UpdateReportInterval(priv, hw->millis);
+
         /* Semi-mt device touch slots do not track touches. When there is a
          * change in the number of touches, we must disregard the temporary
          * motion changes. */
@@ -1674,14 +1968,17 @@ ReadInput(InputInfoPtr pInfo)
             hw->millis = priv->hwState->millis;
 
         SynapticsCopyHwState(priv->hwState, hw);
+        STAGE_BEGIN(STAGE_STATE);
         delay = HandleState(pInfo, hw, hw->millis, FALSE);
+        STAGE_END(STAGE_STATE);
         newDelay = TRUE;
     }
 
     if (newDelay) {
         priv->timer_time = GetTimeInMillis();
-        priv->timer = TimerSet(priv->timer, 0, delay, timerFunc, pInfo);
+        SynapticsSetTimer(pInfo, delay);
     }
+    STAGE_END(STAGE_READ);
 }
 
 static int
@@ -1890,11 +2187,36 @@ SelectTapButton(SynapticsPrivate * priv, enum EdgeType edge)
     priv->tap_button = clamp(priv->tap_button, 0, SYN_MAX_BUTTONS);
 }
 
+/*
+ * Append a state change to the trace ring. There is one writer, the input
+ * thread or SIGIO handler, and it never waits: a reader loads trace_head
+ * and takes the records before it, the writer stores the record first and
+ * then publishes it by advancing trace_head.
+ */
+static void
+SynapticsTraceState(SynapticsPrivate * priv, enum TapState old_tap_state,
+                    CARD32 millis)
+{
+    uint32_t head = priv->trace_head;
+    SynapticsTraceRec *rec = &priv->trace[head % SYNAPTICS_TRACE_SIZE];
+
+    /* a reader that sees the old trace_head must not see the record
+     * overwritten yet */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->millis = millis;
+    rec->state = TRACE_STATE(old_tap_state, priv->tap_state,
+                             priv->hwState->numFingers, priv->moving_state,
+                             priv->three_finger_drag_on);
+    __atomic_store_n(&priv->trace_head, head + 1, __ATOMIC_RELEASE);
+}
+
 static void
 SetTapState(SynapticsPrivate * priv, enum TapState tap_state, CARD32 millis)
 {
-    DBG(3, "SetTapState - %d -> %d (millis:%u)\n", priv->tap_state, tap_state,
-        millis);
+    enum TapState old_tap_state = priv->tap_state;
+
+    DBG(3, "SetTapState - %s -> %s (millis:%u)\n",
+        tap_state_names[priv->tap_state], tap_state_names[tap_state], millis);
     switch (tap_state) {
     case TS_START:
         priv->tap_button_state = TBS_BUTTON_UP;
@@ -1912,15 +2234,21 @@ SetTapState(SynapticsPrivate * priv, enum TapState tap_state, CARD32 millis)
         break;
     case TS_3:
         priv->tap_button_state = TBS_BUTTON_DOWN;
+        priv->tap_drag_events = 0;
         break;
     case TS_SINGLETAP:
 	priv->tap_button_state = TBS_BUTTON_DOWN;
         priv->touch_on.millis = millis;
         break;
+    case TS_3FINGER_START:
+        priv->three_finger_start_millis = millis;
+        break;
     default:
         break;
     }
     priv->tap_state = tap_state;
+    if (tap_state != old_tap_state)
+        SynapticsTraceState(priv, old_tap_state, millis);
 }
 
 static void
@@ -1931,7 +2259,11 @@ SetMovingState(SynapticsPrivate * priv, enum MovingState moving_state,
         priv->moving_state, moving_state, priv->hwState->x, priv->hwState->y,
         millis);
 
+    if (moving_state == priv->moving_state)
+        return;
+
     priv->moving_state = moving_state;
+    SynapticsTraceState(priv, priv->tap_state, millis);
 }
 
 static int
@@ -1959,6 +2291,112 @@ GetTimeOut(SynapticsPrivate * priv)
     }
 }
 
+/* Run the action of a row of tap_transitions, see tapndrag.h */
+static void
+DoTapAction(SynapticsPrivate * priv, struct SynapticsHwState *hw,
+            enum TapAction action, CARD32 now, Bool inside_active_area)
+{
+    switch (action) {
+    case TA_NONE:
+        break;
+    case TA_MOVE:
+        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+        break;
+    case TA_STOP:
+        SetMovingState(priv, MS_FALSE, now);
+        break;
+    case TA_STOP_DRAG:
+        SetMovingState(priv, MS_FALSE, now);
+        priv->three_finger_drag_on = FALSE;
+        break;
+    case TA_SELECT_BUTTON:
+        SelectTapButton(priv, edge_detection(priv, priv->touch_on.x,
+                                             priv->touch_on.y));
+        /* Disable taps outside of the active area */
+        if (!inside_active_area || priv->has_seen_two_finger_scroll)
+            priv->tap_button = 0;
+        break;
+    case TA_NOTE_SCROLL:
+        priv->has_seen_two_finger_scroll = TRUE;
+        break;
+    case TA_3FD_TAP:
+        priv->has_seen_two_finger_scroll = FALSE;
+        priv->three_finger_drag_on = FALSE;
+        priv->tap_button = 2;
+        break;
+    case TA_3FD_START:
+        /* The user has touched for more than the threshold, or started
+         * moving, begin dragging.
+         *
+         * To achieve 3-finger dragging, we must make up for all the side
+         * effects that would have been caused by the usual single-finger
+         * dragging execution path, which is
+         * TS_START ---> TS_1 ----> TS_2A ----> TS_3 ----> TS_DRAG */
+        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+        priv->tap_button_state = TBS_BUTTON_DOWN;
+        priv->tap_button = 1;   /* to post a "Left Button pressed" event */
+        priv->three_finger_drag_on = TRUE;
+        priv->has_seen_two_finger_scroll = FALSE;
+        break;
+    case TA_3FD_JOIN:
+        /* When the user suddenly touches with a finger enter TS_DRAG
+         * immediately */
+        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+        if (!priv->three_finger_drag_on) {
+            priv->tap_button_state = TBS_BUTTON_DOWN;
+            priv->tap_button = 1;
+            priv->three_finger_drag_on = TRUE;
+        }
+        /* touch is not set in this case, so set the touch time manually */
+        priv->touch_on.millis = now;
+        break;
+    case TA_3FD_HOLD:
+        priv->three_finger_last_millis = now;
+        break;
+    case TA_3FD_STOP:
+        /* 1 or 2 fingers stayed on the trackpad for longer than
+         * LockedDragTimeout during a 3-finger drag: finish the drag */
+        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+        priv->three_finger_drag_on = FALSE;
+        priv->tap_button = 1;
+        priv->tap_button_state = TBS_BUTTON_UP;
+        break;
+    case TA_3FD_END:
+        priv->three_finger_drag_on = FALSE;
+        break;
+    case TA_CLICKPAD_HOLD:
+        /* Disable scrolling once a button is pressed on a clickpad */
+        priv->vert_scroll_edge_on = FALSE;
+        priv->horiz_scroll_edge_on = FALSE;
+        priv->vert_scroll_twofinger_on = FALSE;
+        priv->horiz_scroll_twofinger_on = FALSE;
+
+        /* Assume one touch is only for holding the clickpad button down.
+         * This also lets a 3-finger clickpad drag move the pointer instead
+         * of being taken for 2-finger scrolling. */
+        if (hw->numFingers > 1)
+            hw->numFingers = 1;
+        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+
+        /* If we are in a three finger drag, finish it by setting the tap
+         * button to 1 and let the outer code handle the "up" event of
+         * button 1 */
+        if (priv->three_finger_drag_on) {
+            priv->three_finger_drag_on = FALSE;
+            priv->tap_button = 1;
+            priv->tap_button_state = TBS_BUTTON_UP;
+        }
+        break;
+    case TA_CLICKPAD_RELEASE:
+        SetMovingState(priv, MS_FALSE, now);
+        priv->count_packet_finger = 0;
+        priv->finger_velocity = 0;
+        break;
+    case TAP_ACTION_COUNT:
+        break;
+    }
+}
+
 static int
 HandleTapProcessing(SynapticsPrivate * priv, struct SynapticsHwState *hw,
                     CARD32 now, enum FingerState finger,
@@ -1966,9 +2404,10 @@ HandleTapProcessing(SynapticsPrivate * priv, struct SynapticsHwState *hw,
 {
     SynapticsParameters *para = &priv->synpara;
     Bool touch, release, is_timeout, move, press;
+    unsigned int frame_inputs, inputs;
     int timeleft, timeout;
-    enum EdgeType edge;
-    int delay = 1000000000;
+    int delay = NO_DEADLINE;
+    int i;
 
     if (para->touchpad_off == TOUCHPAD_OFF ||
         priv->finger_state == FS_BLOCKED)
@@ -2020,268 +2459,55 @@ HandleTapProcessing(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     timeleft = TIME_DIFF(priv->touch_on.millis + timeout, now);
     is_timeout = timeleft <= 0;
 
- restart:
-    switch (priv->tap_state) {
-    case TS_START:
-        if (touch) {
-			if(hw->numFingers == 3) SetTapState(priv, TS_3FINGER_START, now);
-            else SetTapState(priv, TS_1, now);
-		}
-        break;
-
-	case TS_3FINGER_START:
-        if (para->clickpad && press) {
-            SetTapState(priv, TS_CLICKPAD_MOVE, now);
-            goto restart;
-        }
-		if (release) {
-			priv->has_seen_two_finger_scroll = FALSE;
-			priv->three_finger_drag_on = FALSE;
-			priv->tap_button = 2;
-            SetTapState(priv, TS_SINGLETAP, now);
-			break;
-		}
-		if (is_timeout) {
-	
-			// 2017-03-18:
-			// I think my understanding of timeout is incorrect ... !
-			// The timeout will cause the transition to SINGLETAP to never be executed
-			// TODO: Need to fix the timeout
-
-			// The user has touched for more than the threshold,
-			//    begin dragging
-
-			// To achieve 3-finger dragging, we must make up for all the
-			//   side effects that would have been caused by the usual
-			//   single-finger dragging execution path.
-			//
-			// The usual "drag" path is:
-			// TS_START ---> TS_1 ----> TS_2A ----> TS_3 ----> TS_DRAG
-			// 
-			SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-			SetTapState(priv, TS_DRAG, now);
-			priv->tap_button_state = TBS_BUTTON_DOWN;
-			priv->tap_button = 1;  // to post a "Left Button pressed" event
-			priv->three_finger_drag_on = TRUE;
-			priv->has_seen_two_finger_scroll = FALSE;
-			break;
-		}
-		break;
+    frame_inputs = (touch ? TI_TOUCH : 0) |
+        (release ? TI_RELEASE : 0) |
+        (move ? TI_MOVE : 0) |
+        (is_timeout ? TI_TIMEOUT : 0) |
+        (press ? TI_PRESS : 0) |
+        (para->clickpad ? TI_CLICKPAD : 0) |
+        (finger == FS_TOUCHED ? TI_TOUCHED : 0) |
+        (para->tap_and_drag_gesture ? TI_TAP_AND_DRAG : 0) |
+        (para->locked_drags ? TI_LOCKED : 0);
+    /* Two finger scolling: the deltas would be set to zero, but it is
+     * better if we also prevent the state from entering MOVE */
+    if ((para->scroll_twofinger_vert || para->scroll_twofinger_horiz) &&
+        exceed_bounds && priv->tap_max_fingers == 2)
+        frame_inputs |= TI_2F_SCROLL;
 
-    case TS_1:
-        if (para->clickpad && press) {
-            SetTapState(priv, TS_CLICKPAD_MOVE, now);
-            goto restart;
-        }
-		// Two finger scolling: the deltas would be set to zero,
-		//    but it is better if we also prevent the state from
-		//    entering MOVE ?
-		if ((para->scroll_twofinger_vert || 
-		     para->scroll_twofinger_horiz ) &&
-			 exceed_bounds && priv->tap_max_fingers == 2) {
-			 priv->has_seen_two_finger_scroll = TRUE;
-		}
-		if (hw->numFingers == 3) {
-			SetTapState(priv, TS_3FINGER_START, now);
-			break;
-		}
+ restart:
+    inputs = frame_inputs;
+    if (priv->three_finger_drag_on) {
+        inputs |= TI_3FD | TI_LOCKED;
+        if (hw->numFingers < 3 &&
+            TIME_DIFF(now, priv->three_finger_last_millis +
+                      para->locked_drag_time) > 0)
+            inputs |= TI_3FD_LAPSED;
+    }
+    if (hw->numFingers == 3)
+        inputs |= TI_3FINGERS;
+    /* scans the history, so only where it is used */
+    if (priv->tap_state == TS_3FINGER_START &&
+        three_finger_drag_moving(priv, hw))
+        inputs |= TI_3FD_MOVING;
+
+    for (i = tap_state_rows[priv->tap_state];
+         i < tap_state_rows[priv->tap_state + 1]; i++) {
+        const struct TapTransition *t = &tap_transitions[i];
+
+        if ((inputs & t->all) != t->all || (inputs & t->none))
+            continue;
 
-        if (move)  {
-			SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-			SetTapState(priv, TS_MOVE, now);
-			goto restart;
+        if (t->action != TA_NONE) {
+            DBG(7, "tap action %s in %s\n", tap_action_names[t->action],
+                tap_state_names[priv->tap_state]);
+            DoTapAction(priv, hw, t->action, now, inside_active_area);
         }
-        else if (is_timeout) {
-            if (finger == FS_TOUCHED) {
-                SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-            }
-            SetTapState(priv, TS_MOVE, now);
-            goto restart;
-        }
-        else if (release) {
-            edge = edge_detection(priv, priv->touch_on.x, priv->touch_on.y);
-            SelectTapButton(priv, edge);
-            /* Disable taps outside of the active area */
-            if (!inside_active_area || 
-				(priv->has_seen_two_finger_scroll == TRUE)) {
-                priv->tap_button = 0;
-            }
-            SetTapState(priv, TS_2A, now);
-        }
-        break;
-    case TS_MOVE:
-        if (para->clickpad && press) {
-            SetTapState(priv, TS_CLICKPAD_MOVE, now);
-            goto restart;
-        } else if (hw->numFingers == 3) {
-			// When the user suddenly touches with a finger
-			//   enter TS_DRAG immediately
-			SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-			SetTapState(priv, TS_DRAG, now);
-			if( priv->three_finger_drag_on == FALSE) {
-				priv->tap_button_state = TBS_BUTTON_DOWN;
-				priv->tap_button = 1;  // to post a "Left Button pressed" event
-				priv->three_finger_drag_on = TRUE;
-			}
-			priv->touch_on.millis = now; // Since touch will not be set to TRUE
-			                             //   in this case, we need to set it
-										 //   manually
-			break;
-		}
-        if (release) {
-            SetMovingState(priv, MS_FALSE, now);
-            SetTapState(priv, TS_START, now);
-        }
-        break;
-    case TS_2A:
-        if (touch)
-            SetTapState(priv, TS_3, now);
-        else if (is_timeout)
-            SetTapState(priv, TS_SINGLETAP, now);
-        break;
-    case TS_2B:
-        if (touch)
-            SetTapState(priv, TS_3, now);
-        else if (is_timeout)
-            SetTapState(priv, TS_SINGLETAP, now);
-        break;
-    case TS_SINGLETAP:
-        if (touch)
-            SetTapState(priv, TS_1, now);
-        else if (is_timeout)
-            SetTapState(priv, TS_START, now);
-        break;
-    case TS_3:
-        if (move) {
-            if (para->tap_and_drag_gesture) {
-                SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-                SetTapState(priv, TS_DRAG, now);
-            }
-            else {
-                SetTapState(priv, TS_1, now);
-            }
-            goto restart;
-        }
-        else if (is_timeout) {
-            if (para->tap_and_drag_gesture) {
-                if (finger == FS_TOUCHED) {
-                    SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-                }
-                SetTapState(priv, TS_DRAG, now);
-            }
-            else {
-                SetTapState(priv, TS_1, now);
-            }
-            goto restart;
-        }
-        else if (release) {
-            SetTapState(priv, TS_2B, now);
-        }
-        break;
-    case TS_DRAG:
-        if (para->clickpad && press) {
-            SetTapState(priv, TS_CLICKPAD_MOVE, now);
-            goto restart;
-        }
-		if (priv->three_finger_drag_on == TRUE &&
-			hw->numFingers == 3) {
-			priv->three_finger_last_millis = now;
-		}
-
-		Bool should_stop = FALSE;
-
-		if (priv->three_finger_drag_on == TRUE && hw->numFingers < 3) {
-			// 2017-03-17: Maybe this feels more comfortable
-			if(1 || para->locked_drags) { // Give users the chance to put 3
-									 //      fingers onto the trackpad
-				if (priv->three_finger_last_millis +
-					para->locked_drag_time < now)
-					should_stop = TRUE;
-			} else { 
-				should_stop = TRUE;
-			}
-		}
-		
-		if (should_stop == TRUE) { // 1 or 2 fingers left the trackpad
-								  //   during a 3-finger drag
-								  //   when locked drags is not enabled:
-								  //   finish the drag
-			SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-			SetTapState(priv, TS_MOVE, now);
-			priv->three_finger_drag_on = FALSE;
-			priv->tap_button = 1;
-			priv->tap_button_state = TBS_BUTTON_UP;
-			break;
-		}
+        if (t->flags & TR_STAY)
+            continue;
 
-        if (move)
-            SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-        if (release) {
-            SetMovingState(priv, MS_FALSE, now);
-            if (para->locked_drags || priv->three_finger_drag_on == TRUE) {
-                SetTapState(priv, TS_4, now);
-            }
-            else {
-				if (priv->three_finger_drag_on == TRUE)  // To release button 1
-					priv->tap_button = 1;
-                SetTapState(priv, TS_START, now);
-            }
-        }
-        break;
-    case TS_4:
-        if (is_timeout) {
-            SetTapState(priv, TS_START, now);
-			if (priv->three_finger_drag_on == TRUE) {
-				priv->three_finger_drag_on = FALSE; 
-			}
-            goto restart;
-        }
-        if (touch)
-            SetTapState(priv, TS_5, now);
-        break;
-    case TS_5:
-        if (is_timeout || move) {
-            SetTapState(priv, TS_DRAG, now);
+        SetTapState(priv, t->next, now);
+        if (t->flags & TR_RESTART)
             goto restart;
-        }
-        else if (release) {
-            SetMovingState(priv, MS_FALSE, now);
-            SetTapState(priv, TS_START, now);
-			if (priv->three_finger_drag_on == TRUE) {
-				priv->three_finger_drag_on = FALSE; 
-			}
-        }
-        break;
-    case TS_CLICKPAD_MOVE:
-        /* Disable scrolling once a button is pressed on a clickpad */
-        priv->vert_scroll_edge_on = FALSE;
-        priv->horiz_scroll_edge_on = FALSE;
-        priv->vert_scroll_twofinger_on = FALSE;
-        priv->horiz_scroll_twofinger_on = FALSE;
-
-        /* Assume one touch is only for holding the clickpad button down */
-		/* If we want to do a 3-finger clickpad drag, we have to set the
-		   numFingers to 1 in order to enable the moving after the click,
-		   otherwise numFingers will be 2 and the gesture will be
-		   considered as 2-finger scrolling, and the pointer will not 
-		   move. */
-        if (hw->numFingers > 1)
-            hw->numFingers = 1; // --;
-        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-        if (!press) {
-            SetMovingState(priv, MS_FALSE, now);
-            SetTapState(priv, TS_MOVE, now);
-            priv->count_packet_finger = 0;
-        }
-
-		/* If we are in a three finger drag, finish it
-		   by setting the tap button to 1 and let the 
-		   outer code handle the "up" event of button 1 */
-		if(priv->three_finger_drag_on == TRUE) {
-			priv->three_finger_drag_on = FALSE;
-			priv->tap_button = 1;
-			priv->tap_button_state = TBS_BUTTON_UP;
-		}
         break;
     }
 
@@ -2320,6 +2546,207 @@ estimate_delta(double x0, double x1, double x2, double x3)
     return x0 * 0.3 + x1 * 0.1 - x2 * 0.1 - x3 * 0.3;
 }
 
+/**
+ * Estimate the finger speed in units/ms as the slope of a least-squares
+ * line through the current position and the move history of this touch,
+ * over their timestamps. Unlike the server's estimate from the posted
+ * deltas it doesn't depend on when the events arrive, which makes it
+ * steadier at high report rates.
+ */
+static double
+estimate_velocity(SynapticsPrivate * priv, const struct SynapticsHwState *hw)
+{
+    double st = 0, stt = 0, sx = 0, sy = 0, stx = 0, sty = 0;
+    double t, x, y, d, vx, vy;
+    int n = priv->count_packet_finger;
+    int i;
+
+    for (i = -1; i < n; i++) {
+        t = i < 0 ? 0 : TIME_DIFF(HIST(i).millis, hw->millis);
+        x = i < 0 ? hw->x : HIST(i).x;
+        y = i < 0 ? hw->y : HIST(i).y;
+        st += t;
+        stt += t * t;
+        sx += x;
+        sy += y;
+        stx += t * x;
+        sty += t * y;
+    }
+
+    n++;
+    d = n * stt - st * st;
+    if (d <= 0)
+        return 0;
+
+    vx = (n * stx - st * sx) / d;
+    vy = (n * sty - st * sy) / d;
+
+    return sqrt(vx * vx + vy * vy);
+}
+
+/**
+ * Fit x(t) = c + v t + a t^2 / 2 through the current position and the
+ * move history of this touch by least squares, over their timestamps, and
+ * return the velocity (units/ms) and acceleration (units/ms^2) at the
+ * current position. With fewer than four positions the fit is a line and
+ * the acceleration is 0.
+ */
+static void
+estimate_motion(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
+                double *vx, double *vy, double *ax, double *ay)
+{
+    double s[5] = { 0 }, sx[3] = { 0 }, sy[3] = { 0 };
+    double t, x, y, d;
+    int n = priv->count_packet_finger;
+    int i;
+
+    *vx = *vy = *ax = *ay = 0;
+
+    for (i = -1; i < n; i++) {
+        t = i < 0 ? 0 : TIME_DIFF(HIST(i).millis, hw->millis);
+        x = i < 0 ? hw->x : HIST(i).x;
+        y = i < 0 ? hw->y : HIST(i).y;
+        s[0] += 1;
+        s[1] += t;
+        s[2] += t * t;
+        s[3] += t * t * t;
+        s[4] += t * t * t * t;
+        sx[0] += x;
+        sx[1] += t * x;
+        sx[2] += t * t * x;
+        sy[0] += y;
+        sy[1] += t * y;
+        sy[2] += t * t * y;
+    }
+
+    if (n + 1 >= 4) {
+        /* Cramer's rule on the normal equations of the quadratic fit */
+        d = s[0] * (s[2] * s[4] - s[3] * s[3]) -
+            s[1] * (s[1] * s[4] - s[3] * s[2]) +
+            s[2] * (s[1] * s[3] - s[2] * s[2]);
+        if (d > 0) {
+#define FIT_V(b) ((s[0] * (b[1] * s[4] - s[3] * b[2]) - \
+                   b[0] * (s[1] * s[4] - s[3] * s[2]) + \
+                   s[2] * (s[1] * b[2] - b[1] * s[2])) / d)
+#define FIT_A(b) (2 * (s[0] * (s[2] * b[2] - b[1] * s[3]) - \
+                       s[1] * (s[1] * b[2] - b[1] * s[2]) + \
+                       b[0] * (s[1] * s[3] - s[2] * s[2])) / d)
+            *vx = FIT_V(sx);
+            *vy = FIT_V(sy);
+            *ax = FIT_A(sx);
+            *ay = FIT_A(sy);
+#undef FIT_V
+#undef FIT_A
+            return;
+        }
+    }
+
+    d = s[0] * s[2] - s[1] * s[1];
+    if (d > 0) {
+        *vx = (s[0] * sx[1] - s[1] * sx[0]) / d;
+        *vy = (s[0] * sy[1] - s[1] * sy[0]) / d;
+    }
+}
+
+/**
+ * Motion prediction. Extrapolate the finger MotionPredictionTime ms ahead from
+ * the velocity and acceleration of the move history, and move the pointer
+ * there instead of to the last reported position, to hide part of the
+ * latency between the touchpad and the screen. The lead over the finger
+ * is kept in predict_x/y, the next frame corrects it for what the finger
+ * actually did.
+ *
+ * The acceleration term may shorten the lead but never turn it against
+ * the velocity, and the lead is at most twice what the velocity alone
+ * gives, so noisy fits don't throw the pointer around.
+ *
+ * After a finger change during a 3-finger drag the history starts anew,
+ * see ComputeDeltas(). Until it has enough positions for a fit the lead
+ * is held as it is.
+ */
+static void
+predict_motion(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
+               double *dx, double *dy)
+{
+    double h = priv->synpara.predict_time;
+    double vx, vy, ax, ay, px = 0, py = 0;
+
+    /* a finger at rest or not moving the pointer needs no lead */
+    if ((*dx || *dy) && priv->count_packet_finger < 2) {
+        px = priv->predict_x;
+        py = priv->predict_y;
+    }
+    else if (*dx || *dy) {
+        estimate_motion(priv, hw, &vx, &vy, &ax, &ay);
+        priv->predict_speed = sqrt(vx * vx + vy * vy);
+        px = vx * h + ax * h * h / 2;
+        py = vy * h + ay * h * h / 2;
+        px = vx > 0 ? fmax(0, fmin(px, 2 * vx * h)) :
+            fmin(0, fmax(px, 2 * vx * h));
+        py = vy > 0 ? fmax(0, fmin(py, 2 * vy * h)) :
+            fmin(0, fmax(py, 2 * vy * h));
+    }
+
+    *dx += px - priv->predict_x;
+    *dy += py - priv->predict_y;
+    priv->predict_x = px;
+    priv->predict_y = py;
+}
+
+/**
+ * Decide whether a 3-finger touch in TS_3FINGER_START is a drag before
+ * ThreeFingerDragDelay has passed. That is the case once the fingers are
+ * ThreeFingerDragCommitMove units away from where they came down, and
+ * every frame since TS_3FINGER_START (up to the last three) moved them in
+ * the direction of the velocity estimated from the move history.
+ * A 3-finger tap doesn't travel that far, the delay remains the fallback
+ * for fingers that move slowly or not at all.
+ */
+static Bool
+three_finger_drag_moving(SynapticsPrivate * priv,
+                         const struct SynapticsHwState *hw)
+{
+    SynapticsParameters *para = &priv->synpara;
+    double vx, vy, sx, sy;
+    int dx, dy;
+    int n, i;
+
+    if (para->three_finger_drag_commit_move <= 0)
+        return FALSE;
+
+    /* history entries recorded since TS_3FINGER_START was entered */
+    for (n = 0; n < SYNAPTICS_MOVE_HISTORY; n++)
+        if (TIME_DIFF(HIST(n).millis, priv->three_finger_start_millis) < 0)
+            break;
+    if (n < 2)
+        return FALSE;
+
+    if (n >= 3) {
+        vx = estimate_delta(hw->x, HIST(0).x, HIST(1).x, HIST(2).x);
+        vy = estimate_delta(hw->y, HIST(0).y, HIST(1).y, HIST(2).y);
+    }
+    else {
+        vx = (hw->x - HIST(1).x) / 2.0;
+        vy = (hw->y - HIST(1).y) / 2.0;
+    }
+
+    for (i = 0; i < MIN(n, 3); i++) {
+        sx = (i ? HIST(i - 1).x : hw->x) - HIST(i).x;
+        sy = (i ? HIST(i - 1).y : hw->y) - HIST(i).y;
+        if (sx * vx + sy * vy <= 0)
+            return FALSE;
+    }
+
+    dx = hw->x - priv->touch_on.x;
+    dy = hw->y - priv->touch_on.y;
+    if (dx * vx + dy * vy <= 0)
+        return FALSE;
+
+    return dx * dx + dy * dy >=
+        para->three_finger_drag_commit_move *
+        para->three_finger_drag_commit_move;
+}
+
 /**
  * Applies hysteresis. center is shifted such that it is in range with
  * in by the margin again. The new center is returned.
@@ -2353,6 +2780,66 @@ get_delta(SynapticsPrivate *priv, const struct SynapticsHwState *hw,
     *dy = hw->y - HIST(0).y;
 }
 
+/*
+ * Motion of the centroid of the touches. hw->x/y follow whichever finger
+ * the kernel picks for the single-touch axes and jump when that finger
+ * lifts. Here each touch is compared to its own position in the last
+ * frame and the motion is averaged over the touches that were down in
+ * both, so fingers landing or lifting don't move the pointer. The stored
+ * positions are the touches' hysteresis centers, like hyst_center_x/y for
+ * hw->x/y.
+ *
+ * This runs for every frame to keep the positions up to date, the motion
+ * is only used during a 3-finger drag.
+ */
+static void
+update_slot_positions(SynapticsPrivate * priv,
+                      const struct SynapticsHwState *hw, double *dx,
+                      double *dy)
+{
+    SynapticsParameters *para = &priv->synpara;
+    double sum_x = 0, sum_y = 0;
+    int i, n = 0;
+
+    for (i = 0; i < hw->num_slots && i < priv->num_slots; i++) {
+        SynapticsSlotPosRec *pos = &priv->slot_pos[i];
+        int x, y;
+
+        if (hw->slot_state[i] == SLOTSTATE_EMPTY ||
+            hw->slot_state[i] == SLOTSTATE_CLOSE) {
+            pos->valid = FALSE;
+            continue;
+        }
+
+        x = hw->slot_x[i];
+        y = hw->slot_y[i];
+
+        /* a new touch, possibly in a slot reused within the same frame */
+        if (!pos->valid || hw->slot_state[i] == SLOTSTATE_OPEN) {
+            pos->valid = TRUE;
+            pos->x = x;
+            pos->y = y;
+            continue;
+        }
+
+        x = hysteresis(x, pos->x, para->hyst_x);
+        y = hysteresis(y, pos->y, para->hyst_y);
+        sum_x += x - pos->x;
+        sum_y += y - pos->y;
+        pos->x = x;
+        pos->y = y;
+        n++;
+    }
+
+    *dx = n ? sum_x / n : 0;
+    *dy = n ? sum_y / n : 0;
+
+#ifndef NO_DRIVER_SCALING
+    *dx *= priv->horiz_coeff;
+    *dy *= priv->vert_coeff;
+#endif
+}
+
 /* Vector length, but not sqrt'ed, we only need it for comparison */
 static inline double
 vlenpow2(double x, double y)
@@ -2365,14 +2852,18 @@ vlenpow2(double x, double y)
  */
 static int
 ComputeDeltas(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
-              enum EdgeType edge, int *dxP, int *dyP, Bool inside_area)
+              enum EdgeType edge, double *dxP, double *dyP, Bool inside_area)
 {
     enum MovingState moving_state;
     double dx, dy;
     double vlen;
-    int delay = 1000000000;
+    int delay = NO_DEADLINE;
+    /* fingers may come and go during a 3-finger drag, follow all of them */
+    Bool centroid = priv->three_finger_drag_on && priv->num_slots > 0;
+    double centroid_dx, centroid_dy;
 
     dx = dy = 0;
+    update_slot_positions(priv, hw, &centroid_dx, &centroid_dy);
 
     moving_state = priv->moving_state;
     if (moving_state == MS_FALSE) {
@@ -2394,31 +2885,51 @@ ComputeDeltas(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
     if (!inside_area || !moving_state || priv->finger_state == FS_BLOCKED ||
         priv->vert_scroll_edge_on || priv->horiz_scroll_edge_on ||
         priv->vert_scroll_twofinger_on || priv->horiz_scroll_twofinger_on ||
-        priv->circ_scroll_on || priv->prevFingers != hw->numFingers// ||
+        priv->circ_scroll_on ||
+        (priv->prevFingers != hw->numFingers && !centroid)// ||
         /*(moving_state == MS_TOUCHPAD_RELATIVE && hw->numFingers != 1)*/) {
-        /* reset packet counter. */
+        /* reset packet counter, the next touch gets a speed of its own */
         priv->count_packet_finger = 0;
+        priv->finger_velocity = 0;
         goto out;
     }
 
+    if (centroid) {
+        /* The centroid motion needs no history, but hw->x/y may have
+         * jumped to another finger. The estimators below fit the history,
+         * so it starts anew as for a single touch. */
+        if (priv->prevFingers != hw->numFingers) {
+            priv->count_packet_finger = 0;
+            priv->finger_velocity = 0;
+        }
+        if (moving_state == MS_TOUCHPAD_RELATIVE) {
+            dx = centroid_dx;
+            dy = centroid_dy;
+        }
+    }
+    else if (priv->count_packet_finger <= 1)
+        goto out;               /* skip the lot */
+    else if (moving_state == MS_TOUCHPAD_RELATIVE)
+        get_delta(priv, hw, edge, &dx, &dy);
+
     /* To create the illusion of fluid motion, call back at roughly the report
      * rate, even in the absence of new hardware events; see comment above
-     * POLL_MS declaration. */
-    delay = MIN(delay, POLL_MS);
-
-    if (priv->count_packet_finger <= 1)
-        goto out;               /* skip the lot */
+     * POLL_MS declaration. A finger at rest doesn't need that. */
+    if (dx || dy)
+        delay = MIN(delay, poll_delay(priv));
 
-    if (moving_state == MS_TOUCHPAD_RELATIVE)
-        get_delta(priv, hw, edge, &dx, &dy);
+    /* with too short a history the last estimate of this touch stands */
+    if (priv->synpara.velocity_estimator == VELOCITY_HISTORY &&
+        priv->count_packet_finger > 1)
+        priv->finger_velocity = estimate_velocity(priv, hw);
 
  out:
     priv->prevFingers = hw->numFingers;
 
-    vlen = vlenpow2(dx/priv->synpara.resolution_horiz,
-                    dy/priv->synpara.resolution_vert);
+    vlen = vlenpow2(dx * priv->derived.inv_resolution_horiz,
+                    dy * priv->derived.inv_resolution_vert);
 
-    if (vlen > priv->synpara.maxDeltaMM * priv->synpara.maxDeltaMM) {
+    if (vlen > priv->derived.max_delta_sq) {
         dx = 0;
         dy = 0;
     }
@@ -2508,6 +3019,16 @@ start_coasting(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     priv->scroll.packets_this_scroll = 0;
 }
 
+/* No scrolling or coasting while the pad or tapping is off, the finger is
+ * blocked or the fingers drag */
+static Bool
+scrolling_off(const SynapticsPrivate * priv)
+{
+    return priv->synpara.touchpad_off == TOUCHPAD_TAP_OFF ||
+        priv->synpara.touchpad_off == TOUCHPAD_OFF ||
+        priv->finger_state == FS_BLOCKED || priv->three_finger_drag_on;
+}
+
 static void
 stop_coasting(SynapticsPrivate * priv)
 {
@@ -2516,17 +3037,60 @@ stop_coasting(SynapticsPrivate * priv)
     priv->scroll.packets_this_scroll = 0;
 }
 
+/*
+ * Advance coasting to now. Only needs the time, so the timer can run it
+ * on its own when coasting is the only thing pending.
+ */
+static int
+HandleCoasting(SynapticsPrivate * priv, CARD32 now)
+{
+    SynapticsParameters *para = &priv->synpara;
+    int delay = NO_DEADLINE;
+
+    if (priv->scroll.coast_speed_y) {
+        double dtime = (now - priv->scroll.last_millis) / 1000.0;
+        double ddy = para->coasting_friction * dtime;
+
+        priv->scroll.delta_y += priv->scroll.coast_speed_y * dtime * abs(para->scroll_dist_vert);
+        /* coasting has no reports to keep up with, so don't wake up any
+         * faster than we used to on fast pads */
+        delay = MIN(delay, MAX(poll_delay(priv), POLL_MS));
+        if (abs(priv->scroll.coast_speed_y) < ddy) {
+            priv->scroll.coast_speed_y = 0;
+            priv->scroll.packets_this_scroll = 0;
+        }
+        else {
+            priv->scroll.coast_speed_y +=
+                (priv->scroll.coast_speed_y < 0 ? ddy : -ddy);
+        }
+    }
+
+    if (priv->scroll.coast_speed_x) {
+        double dtime = (now - priv->scroll.last_millis) / 1000.0;
+        double ddx = para->coasting_friction * dtime;
+        priv->scroll.delta_x += priv->scroll.coast_speed_x * dtime * abs(para->scroll_dist_horiz);
+        delay = MIN(delay, MAX(poll_delay(priv), POLL_MS));
+        if (abs(priv->scroll.coast_speed_x) < ddx) {
+            priv->scroll.coast_speed_x = 0;
+            priv->scroll.packets_this_scroll = 0;
+        }
+        else {
+            priv->scroll.coast_speed_x +=
+                (priv->scroll.coast_speed_x < 0 ? ddx : -ddx);
+        }
+    }
+
+    return delay;
+}
+
 static int
 HandleScrolling(SynapticsPrivate * priv, struct SynapticsHwState *hw,
                 enum EdgeType edge, Bool finger)
 {
     SynapticsParameters *para = &priv->synpara;
-    int delay = 1000000000;
+    int delay = NO_DEADLINE;
 
-    if (priv->synpara.touchpad_off == TOUCHPAD_TAP_OFF ||
-        priv->synpara.touchpad_off == TOUCHPAD_OFF ||
-        priv->finger_state == FS_BLOCKED ||
-		priv->three_finger_drag_on == TRUE) {
+    if (scrolling_off(priv)) {
         stop_coasting(priv);
         priv->circ_scroll_on = FALSE;
         priv->vert_scroll_edge_on = FALSE;
@@ -2745,38 +3309,7 @@ HandleScrolling(SynapticsPrivate * priv, struct SynapticsHwState *hw,
         }
     }
 
-    if (priv->scroll.coast_speed_y) {
-        double dtime = (hw->millis - priv->scroll.last_millis) / 1000.0;
-        double ddy = para->coasting_friction * dtime;
-
-        priv->scroll.delta_y += priv->scroll.coast_speed_y * dtime * abs(para->scroll_dist_vert);
-        delay = MIN(delay, POLL_MS);
-        if (abs(priv->scroll.coast_speed_y) < ddy) {
-            priv->scroll.coast_speed_y = 0;
-            priv->scroll.packets_this_scroll = 0;
-        }
-        else {
-            priv->scroll.coast_speed_y +=
-                (priv->scroll.coast_speed_y < 0 ? ddy : -ddy);
-        }
-    }
-
-    if (priv->scroll.coast_speed_x) {
-        double dtime = (hw->millis - priv->scroll.last_millis) / 1000.0;
-        double ddx = para->coasting_friction * dtime;
-        priv->scroll.delta_x += priv->scroll.coast_speed_x * dtime * abs(para->scroll_dist_horiz);
-        delay = MIN(delay, POLL_MS);
-        if (abs(priv->scroll.coast_speed_x) < ddx) {
-            priv->scroll.coast_speed_x = 0;
-            priv->scroll.packets_this_scroll = 0;
-        }
-        else {
-            priv->scroll.coast_speed_x +=
-                (priv->scroll.coast_speed_x < 0 ? ddx : -ddx);
-        }
-    }
-
-    return delay;
+    return HandleCoasting(priv, hw->millis);
 }
 
 /**
@@ -2791,39 +3324,30 @@ clickpad_guess_clickfingers(SynapticsPrivate * priv,
     uint32_t close_point = 0; /* 1 bit for each point close to another one */
     int i, j;
 
-    BUG_RETURN_VAL(hw->num_mt_mask > sizeof(close_point) * 8, 0);
+    BUG_RETURN_VAL(hw->num_slots > sizeof(close_point) * 8, 0);
 
-    for (i = 0; i < hw->num_mt_mask - 1; i++) {
-        ValuatorMask *f1;
+    for (i = 0; i < hw->num_slots - 1; i++) {
+        int x1, y1;
 
         if (hw->slot_state[i] == SLOTSTATE_EMPTY ||
             hw->slot_state[i] == SLOTSTATE_CLOSE)
             continue;
 
-        f1 = hw->mt_mask[i];
+        x1 = hw->slot_x[i];
+        y1 = hw->slot_y[i];
 
-        for (j = i + 1; j < hw->num_mt_mask; j++) {
-            ValuatorMask *f2;
-            double x1, x2, y1, y2;
+        for (j = i + 1; j < hw->num_slots; j++) {
+            int x2, y2;
 
             if (hw->slot_state[j] == SLOTSTATE_EMPTY ||
                 hw->slot_state[j] == SLOTSTATE_CLOSE)
                 continue;
 
-            f2 = hw->mt_mask[j];
-
-            x1 = valuator_mask_get_double(f1, 0);
-            y1 = valuator_mask_get_double(f1, 1);
+            x2 = hw->slot_x[j];
+            y2 = hw->slot_y[j];
 
-            x2 = valuator_mask_get_double(f2, 0);
-            y2 = valuator_mask_get_double(f2, 1);
-
-            /* FIXME: fingers closer together than 30% of touchpad width, but
-             * really, this should be dependent on the touchpad size. Also,
-             * you'll need to find a touchpad that doesn't lie about it's
-             * size. Good luck. */
-            if (abs(x1 - x2) < (priv->maxx - priv->minx) * .3 &&
-                abs(y1 - y2) < (priv->maxy - priv->miny) * .3) {
+            if (abs(x1 - x2) < priv->derived.clickfinger_dist_x &&
+                abs(y1 - y2) < priv->derived.clickfinger_dist_y) {
                 close_point |= (1 << j);
                 close_point |= (1 << i);
             }
@@ -2839,7 +3363,7 @@ clickpad_guess_clickfingers(SynapticsPrivate * priv,
      * BTN_TOOL_TRIPLETAP (which sets hw->numFingers to 3), when this happens
      * the user likely intents to do a 3 finger click, so handle it as such.
      */
-    if (hw->numFingers >= 3 && hw->num_mt_mask < 3)
+    if (hw->numFingers >= 3 && hw->num_slots < 3)
         nfingers = 3;
 
     return nfingers;
@@ -2952,19 +3476,22 @@ update_hw_button_state(const InputInfoPtr pInfo, struct SynapticsHwState *hw,
                 hw->left = 0;
                 goto out;
             }
-            if (is_inside_rightbutton_area(para, hw->x, hw->y)) {
+            if (is_inside_rightbutton_area(&priv->derived, hw->x, hw->y)) {
                 hw->left = 0;
                 hw->right = 1;
             }
-            else if (is_inside_sec_rightbutton_area(para, hw->x, hw->y)) {
+            else if (is_inside_sec_rightbutton_area(&priv->derived,
+                                                    hw->x, hw->y)) {
                 hw->left = 0;
                 hw->right = 1;
             }
-            else if (is_inside_middlebutton_area(para, hw->x, hw->y)) {
+            else if (is_inside_middlebutton_area(&priv->derived,
+                                                 hw->x, hw->y)) {
                 hw->left = 0;
                 hw->middle = 1;
             }
-            else if (is_inside_sec_middlebutton_area(para, hw->x, hw->y)) {
+            else if (is_inside_sec_middlebutton_area(&priv->derived,
+                                                     hw->x, hw->y)) {
                 hw->left = 0;
                 hw->middle = 1;
             }
@@ -2998,6 +3525,35 @@ post_button_click(const InputInfoPtr pInfo, const int button)
     xf86PostButtonEvent(pInfo->dev, FALSE, button, FALSE, 0, 0);
 }
 
+static void
+post_motion_event(const InputInfoPtr pInfo, double dx, double dy)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+
+    valuator_mask_zero(priv->motion_events_mask);
+    valuator_mask_set_double(priv->motion_events_mask, 0, dx);
+    valuator_mask_set_double(priv->motion_events_mask, 1, dy);
+    xf86PostMotionEventM(pInfo->dev, FALSE, priv->motion_events_mask);
+}
+
+/* Keep a motion event posted in TS_3. Once the buffer is full the rest
+ * adds to the last entry. */
+static void
+record_tap_drag(SynapticsPrivate * priv, double dx, double dy)
+{
+    int i = priv->tap_drag_events;
+
+    if (i < SYNAPTICS_TAP_DRAG_EVENTS)
+        priv->tap_drag_events++;
+    else {
+        i--;
+        dx += priv->tap_drag[i].dx;
+        dy += priv->tap_drag[i].dy;
+    }
+    priv->tap_drag[i].dx = dx;
+    priv->tap_drag[i].dy = dy;
+}
+
 static void
 post_scroll_events(const InputInfoPtr pInfo)
 {
@@ -3079,34 +3635,20 @@ repeat_scrollbuttons(const InputInfoPtr pInfo,
     return delay;
 }
 
-/* Update the open slots and number of active touches */
+/* Update the open slots. A slot closed and reopened within the same frame
+ * is OPEN and stays set. */
 static void
 UpdateTouchState(InputInfoPtr pInfo, struct SynapticsHwState *hw)
 {
     SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
     int i;
 
-    for (i = 0; i < hw->num_mt_mask; i++) {
-        if (hw->slot_state[i] == SLOTSTATE_OPEN) {
-            priv->open_slots[priv->num_active_touches] = i;
-            priv->num_active_touches++;
-            BUG_WARN(priv->num_active_touches > priv->num_slots);
-        }
+    for (i = 0; i < hw->num_slots; i++) {
+        if (hw->slot_state[i] == SLOTSTATE_OPEN)
+            priv->open_slots |= 1U << i;
         else if (hw->slot_state[i] == SLOTSTATE_CLOSE) {
-            Bool found = FALSE;
-            int j;
-
-            for (j = 0; j < priv->num_active_touches - 1; j++) {
-                if (priv->open_slots[j] == i)
-                    found = TRUE;
-
-                if (found)
-                    priv->open_slots[j] = priv->open_slots[j + 1];
-            }
-
-            BUG_WARN(priv->num_active_touches == 0);
-            if (priv->num_active_touches > 0)
-                priv->num_active_touches--;
+            BUG_WARN(!(priv->open_slots & (1U << i)));
+            priv->open_slots &= ~(1U << i);
         }
     }
 
@@ -3116,18 +3658,6 @@ UpdateTouchState(InputInfoPtr pInfo, struct SynapticsHwState *hw)
 static void
 HandleTouches(InputInfoPtr pInfo, struct SynapticsHwState *hw)
 {
-    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
-    int new_active_touches = priv->num_active_touches;
-    int i;
-
-    /* Count new number of active touches */
-    for (i = 0; i < hw->num_mt_mask; i++) {
-        if (hw->slot_state[i] == SLOTSTATE_OPEN)
-            new_active_touches++;
-        else if (hw->slot_state[i] == SLOTSTATE_CLOSE)
-            new_active_touches--;
-    }
-
     UpdateTouchState(pInfo, hw);
 }
 
@@ -3169,23 +3699,27 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
     SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
     SynapticsParameters *para = &priv->synpara;
     enum FingerState finger = FS_UNTOUCHED;
-    int dx = 0, dy = 0, buttons, id;
+    double dx = 0, dy = 0;
+    int buttons, id;
     enum EdgeType edge = NO_EDGE;
     int change;
     int double_click = FALSE;
-    int delay = 1000000000;
     int timeleft;
     Bool inside_active_area;
     Bool using_cumulative_coords = FALSE;
     Bool ignore_motion;
 
+    priv->events_posted = FALSE;
+
     /* We need both and x/y, the driver can't handle just one of the two
      * yet. But since it's possible to hit a phys button on non-clickpads
      * without ever getting motion data first, we must continue with 0/0 for
      * that case. */
     if (hw->x == INT_MIN || hw->y == INT_MAX) {
-        if (para->clickpad)
-            return delay;
+        if (para->clickpad) {
+            priv->pending_deadlines = 0;
+            return NO_DEADLINE;
+        }
         else if (hw->left || hw->right || hw->middle) {
             hw->x = (hw->x == INT_MIN) ? 0 : hw->x;
             hw->y = (hw->y == INT_MIN) ? 0 : hw->y;
@@ -3212,18 +3746,21 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
 
     /* Ignore motion *starting* inside softbuttonareas */
     if (priv->finger_state < FS_TOUCHED)
-        priv->last_button_area = current_button_area(para, hw->x, hw->y);
+        priv->last_button_area =
+            current_button_area(&priv->derived, hw->x, hw->y);
     /* If we already have a finger down, clear last_button_area if it goes
        outside of the softbuttonareas */
     else if (priv->last_button_area != NO_BUTTON_AREA &&
-             current_button_area(para, hw->x, hw->y) == NO_BUTTON_AREA)
+             current_button_area(&priv->derived, hw->x, hw->y) == NO_BUTTON_AREA)
         priv->last_button_area = NO_BUTTON_AREA;
 
     ignore_motion = para->touchpad_off == TOUCHPAD_OFF ||
         (!using_cumulative_coords && priv->last_button_area != NO_BUTTON_AREA);
 
     /* these two just update hw->left, right, etc. */
-    update_hw_button_state(pInfo, hw, now, &delay);
+    timeleft = NO_DEADLINE;
+    update_hw_button_state(pInfo, hw, now, &timeleft);
+    SetDeadline(priv, DEADLINE_MID_BUTTON, now, timeleft);
     if (priv->has_scrollbuttons)
         double_click = adjust_state_from_scrollbuttons(pInfo, hw);
 
@@ -3254,15 +3791,17 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
 
     /* tap and drag detection. Needs to be performed even if the finger is in
      * the dead area to reset the state. */
+    STAGE_BEGIN(STAGE_TAP);
     timeleft = HandleTapProcessing(priv, hw, now, finger, inside_active_area);
-    if (timeleft > 0)
-        delay = MIN(delay, timeleft);
+    STAGE_END(STAGE_TAP);
+    SetDeadline(priv, DEADLINE_TAP, now, timeleft);
 
     if (inside_active_area) {
         /* Don't bother about scrolling in the dead area of the touchpad. */
+        STAGE_BEGIN(STAGE_SCROLL);
         timeleft = HandleScrolling(priv, hw, edge, (finger >= FS_TOUCHED));
-        if (timeleft > 0)
-            delay = MIN(delay, timeleft);
+        STAGE_END(STAGE_SCROLL);
+        SetDeadline(priv, DEADLINE_COAST, now, timeleft);
 
         /*
          * Compensate for unequal x/y resolution. This needs to be done after
@@ -3273,11 +3812,18 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
         ScaleCoordinates(priv, hw);
 #endif
     }
+    else
+        SetDeadline(priv, DEADLINE_COAST, now, NO_DEADLINE);
 
     dx = dy = 0;
 
+    STAGE_BEGIN(STAGE_DELTAS);
     timeleft = ComputeDeltas(priv, hw, edge, &dx, &dy, inside_active_area);
-    delay = MIN(delay, timeleft);
+    if (para->predict_time > 0 && !from_timer && finger >= FS_TOUCHED &&
+        !ignore_motion)
+        predict_motion(priv, hw, &dx, &dy);
+    STAGE_END(STAGE_DELTAS);
+    SetDeadline(priv, DEADLINE_MOTION, now, timeleft);
 
     buttons = ((hw->left ? 0x01 : 0) |
                (hw->middle ? 0x02 : 0) |
@@ -3289,20 +3835,89 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
     if (priv->tap_button > 0 && priv->tap_button_state == TBS_BUTTON_DOWN)
         buttons |= 1 << (priv->tap_button - 1);
 
-    /* Post events */
-    if (finger >= FS_TOUCHED && (dx || dy) && !ignore_motion)
-        xf86PostMotionEvent(pInfo->dev, 0, 0, 2, dx, dy);
+    STAGE_BEGIN(STAGE_POST);
+
+    /* Post events. Motion of less than a unit is carried over to the next
+     * frame instead of being posted on its own, the sum is posted with its
+     * fractional part once it adds up to a unit on either axis. */
+    if (finger < FS_TOUCHED) {
+        priv->motion_rem_x = 0;
+        priv->motion_rem_y = 0;
+    }
+    else if ((dx || dy) && !ignore_motion) {
+        dx += priv->motion_rem_x;
+        dy += priv->motion_rem_y;
+        if (fabs(dx) >= 1 || fabs(dy) >= 1) {
+            post_motion_event(pInfo, dx, dy);
+            priv->events_posted = TRUE;
+            priv->motion_rem_x = 0;
+            priv->motion_rem_y = 0;
+
+            /* the button is already down in TS_3, the motion is a drag until
+             * the touch turns out to be the second tap of a double tap */
+            if (priv->tap_state == TS_3 && para->tap_and_drag_rollback)
+                record_tap_drag(priv, dx, dy);
+        }
+        else {
+            priv->motion_rem_x = dx;
+            priv->motion_rem_y = dy;
+        }
+    }
+
+    /* The finger is gone, take back the lead the predictor gave the pointer.
+     * It goes back at the speed the finger last moved at, in a step per
+     * timer period, so the server accelerates it like the motion it was
+     * added to. */
+    if (finger < FS_TOUCHED && (priv->predict_x || priv->predict_y)) {
+        double lead = sqrt(priv->predict_x * priv->predict_x +
+                           priv->predict_y * priv->predict_y);
+        double step = priv->predict_speed * poll_delay(priv);
+
+        if (step > 0 && step < lead) {
+            double f = step / lead;
+
+            post_motion_event(pInfo, -priv->predict_x * f,
+                              -priv->predict_y * f);
+            priv->predict_x -= priv->predict_x * f;
+            priv->predict_y -= priv->predict_y * f;
+            SetDeadline(priv, DEADLINE_MOTION, now, poll_delay(priv));
+        }
+        else {
+            post_motion_event(pInfo, -priv->predict_x, -priv->predict_y);
+            priv->predict_x = 0;
+            priv->predict_y = 0;
+        }
+        priv->events_posted = TRUE;
+    }
+
+    /* It was a double tap after all: move the pointer back before the
+     * button is released, so both clicks happen where the first one did.
+     * The motion is undone event by event, in reverse. One event for all
+     * of it would be accelerated differently from the ones it undoes. */
+    if (priv->tap_state == TS_2B && priv->tap_drag_events > 0) {
+        while (priv->tap_drag_events > 0) {
+            int i = --priv->tap_drag_events;
+
+            post_motion_event(pInfo, -priv->tap_drag[i].dx,
+                              -priv->tap_drag[i].dy);
+        }
+        priv->events_posted = TRUE;
+    }
 
     if (priv->mid_emu_state == MBE_LEFT_CLICK) {
         post_button_click(pInfo, 1);
         priv->mid_emu_state = MBE_OFF;
+        priv->events_posted = TRUE;
     }
     else if (priv->mid_emu_state == MBE_RIGHT_CLICK) {
         post_button_click(pInfo, 3);
         priv->mid_emu_state = MBE_OFF;
+        priv->events_posted = TRUE;
     }
 
     change = buttons ^ priv->lastButtons;
+    if (change)
+        priv->events_posted = TRUE;
     while (change) {
         id = ffs(change);       /* number of first set bit 1..32 is returned */
         change &= ~(1 << (id - 1));
@@ -3311,7 +3926,9 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
     }
 
     if (priv->has_scrollbuttons)
-        delay = repeat_scrollbuttons(pInfo, hw, buttons, now, delay);
+        SetDeadline(priv, DEADLINE_REPEAT, now,
+                    repeat_scrollbuttons(pInfo, hw, buttons, now,
+                                         NO_DEADLINE));
 
     /* Process scroll events only if coordinates are
      * in the Synaptics Area
@@ -3320,14 +3937,20 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
         (priv->scroll.delta_x != 0.0 || priv->scroll.delta_y != 0.0)) {
         post_scroll_events(pInfo);
         priv->scroll.last_millis = hw->millis;
+        priv->events_posted = TRUE;
     }
 
     if (double_click) {
         post_button_click(pInfo, 1);
         post_button_click(pInfo, 1);
+        priv->events_posted = TRUE;
     }
+    STAGE_END(STAGE_POST);
 
-    HandleTouches(pInfo, hw);
+    /* The timer reports no new touches, and its hardware state shares the
+     * touches of the last frame, see timerFunc() */
+    if (!from_timer)
+        HandleTouches(pInfo, hw);
 
     /* Save old values of some state variables */
     priv->finger_state = finger;
@@ -3337,7 +3960,7 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
     if (inside_active_area)
         store_history(priv, hw->x, hw->y, hw->millis);
 
-    return delay;
+    return NextDeadline(priv, now);
 }
 
 static int
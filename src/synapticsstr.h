@@ -40,25 +40,40 @@
 #define HAVE_THREADED_INPUT 1
 #endif
 
-#define DEBUG
+/* DBG() messages up to this verbosity are compiled in, the others cost
+ * nothing. Set with --with-max-log-level. */
+#ifndef SYNAPTICS_MAX_LOG_LEVEL
+#ifdef MAX_LOG_LEVEL
+#define SYNAPTICS_MAX_LOG_LEVEL MAX_LOG_LEVEL
+#else
+#define SYNAPTICS_MAX_LOG_LEVEL 0
+#endif
+#endif
+
+/* The higher of the server's stderr and log file verbosity, read in
+ * PreInit. Messages above it go to neither and are dropped before their
+ * arguments are evaluated. */
+extern int synaptics_log_verbosity;
 
 #ifdef DBG
 #undef DBG
 #endif
 
-#ifdef DEBUG
 #define DBG(verb, ...) \
-    xf86MsgVerb(X_INFO, verb, __VA_ARGS__)
-#else
-#define DBG(verb, msg, ...)     /* */
-#endif
+    do { \
+        if ((verb) <= SYNAPTICS_MAX_LOG_LEVEL && \
+            (verb) <= synaptics_log_verbosity) \
+            xf86MsgVerb(X_INFO, verb, __VA_ARGS__); \
+    } while (0)
 
 /******************************************************************************
  *		Definitions
  *					structs, typedefs, #defines, enums
  *****************************************************************************/
 #define SYNAPTICS_MOVE_HISTORY	5
+#define SYNAPTICS_TAP_DRAG_EVENTS	32      /* Kept for tap_and_drag_rollback */
 #define SYNAPTICS_MAX_TOUCHES	10
+#define SYNAPTICS_MAX_SLOTS	32      /* Bits in open_slots */
 #define SYN_MAX_BUTTONS 12      /* Max number of mouse buttons */
 
 /* Minimum and maximum values for scroll_button_repeat */
@@ -71,6 +86,12 @@ enum OffState {
     TOUCHPAD_TAP_OFF = 2,
 };
 
+/* Source of the finger velocity the acceleration profile works with */
+enum VelocityEstimator {
+    VELOCITY_SERVER = 0,        /* the server's estimate from the posted motion */
+    VELOCITY_HISTORY = 1,       /* least-squares fit over the move history */
+};
+
 enum TapEvent {
     RT_TAP = 0,                 /* Right top corner */
     RB_TAP,                     /* Right bottom corner */
@@ -95,6 +116,11 @@ typedef struct _SynapticsMoveHist {
     CARD32 millis;
 } SynapticsMoveHistRec;
 
+typedef struct _SynapticsSlotPos {
+    Bool valid;                 /* slot had a touch */
+    int x, y;
+} SynapticsSlotPosRec;
+
 typedef struct _SynapticsTouchAxis {
     const char *label;
     int min;
@@ -125,7 +151,58 @@ enum MidButtonEmulation {
     MBE_RIGHT_CLICK,            /* Emulate right button click. */
 };
 
-/* See docs/tapndrag.dia for a state machine diagram */
+/* Timeouts the driver waits for, one entry each in the deadline queue */
+enum SynapticsDeadline {
+    DEADLINE_MID_BUTTON,        /* middle button emulation */
+    DEADLINE_TAP,               /* tap and drag timeouts */
+    DEADLINE_COAST,             /* next coasting step */
+    DEADLINE_MOTION,            /* synthetic motion between reports */
+    DEADLINE_REPEAT,            /* scroll button repeat */
+    DEADLINE_COUNT
+};
+
+/* Stages of input processing timed into the rows of the Synaptics Stage
+ * Latency property, in the order of the rows. A timer callback is timed as
+ * a whole in STAGE_TIMER, not as a frame in STAGE_STATE; the stages within
+ * HandleState are counted on either path. */
+enum SynapticsStage {
+    STAGE_READ,                 /* ReadInput, all frames of one wakeup */
+    STAGE_HW,                   /* reading one frame from the device */
+    STAGE_STATE,                /* HandleState for a frame */
+    STAGE_TAP,                  /* HandleTapProcessing */
+    STAGE_SCROLL,               /* HandleScrolling */
+    STAGE_DELTAS,               /* ComputeDeltas and motion prediction */
+    STAGE_POST,                 /* posting the events of a frame */
+    STAGE_TIMER,                /* a timer callback, coasting or HandleState */
+    STAGE_COUNT
+};
+
+/* Records kept in the state trace ring, a power of two */
+#define SYNAPTICS_TRACE_SIZE	256
+
+/* A change of the tap or moving state, see SynapticsTraceState(). The
+ * state word packs the old tap state in bits 0-7, the new one in bits
+ * 8-15, the number of fingers in bits 16-23, the moving state in bits
+ * 24-30 and three_finger_drag_on in bit 31, as the Synaptics State Trace
+ * property shows it. */
+typedef struct _SynapticsTraceRec {
+    CARD32 millis;
+    CARD32 state;
+} SynapticsTraceRec;
+
+#define TRACE_STATE(old_tap, new_tap, fingers, moving, three_finger_drag) \
+    (((old_tap) & 0xff) | (((new_tap) & 0xff) << 8) | \
+     (((fingers) & 0xff) << 16) | (((moving) & 0x7f) << 24) | \
+     ((three_finger_drag) ? 1U << 31 : 0))
+
+/* Bucket 0 counts stages that took less than STAGE_BUCKET_MIN_NS, bucket n
+ * those that took STAGE_BUCKET_MIN_NS / 2 * 2^n ns up to twice that, the
+ * last bucket everything longer */
+#define STAGE_BUCKETS		16
+#define STAGE_BUCKET_MIN_NS	128
+
+/* The transitions are in tapndrag.c, docs/tapndrag.dia is a diagram of
+ * them generated by bench/tapgraph */
 enum TapState {
     TS_START,                   /* No tap/drag in progress */
     TS_1,                       /* After first touch */
@@ -197,6 +274,8 @@ typedef struct _SynapticsParameters {
     Bool scroll_twofinger_vert; /* Enable/disable vertical two-finger scrolling */
     Bool scroll_twofinger_horiz;        /* Enable/disable horizontal two-finger scrolling */
     double min_speed, max_speed, accl;  /* movement parameters */
+    int velocity_estimator;     /* enum VelocityEstimator */
+    int predict_time;           /* How far ahead (in ms) to extrapolate motion, 0 for no prediction */
 
     Bool updown_button_scrolling;       /* Up/Down-Button scrolling or middle/double-click */
     Bool leftright_button_scrolling;    /* Left/right-button scrolling, or two lots of middle button */
@@ -228,6 +307,7 @@ typedef struct _SynapticsParameters {
     double press_motion_max_factor;     /* factor applied on speed when finger pressure is at minimum */
     Bool grab_event_device;     /* grab event device for exclusive use? */
     Bool tap_and_drag_gesture;  /* Switches the tap-and-drag gesture on/off */
+    Bool tap_and_drag_rollback; /* Undo the motion of a tap-and-drag that ends as a double tap */
     unsigned int resolution_horiz;      /* horizontal resolution of touchpad in units/mm */
     unsigned int resolution_vert;       /* vertical resolution of touchpad in units/mm */
     int area_left_edge, area_right_edge, area_top_edge, area_bottom_edge;       /* area coordinates absolute */
@@ -238,27 +318,76 @@ typedef struct _SynapticsParameters {
     int three_finger_drag_delay;   /* The time that must elapse before
                                       transitioning from a 3-finger touch
                                       to a 3-finger drag */
+    int three_finger_drag_commit_move;  /* Movement that starts a 3-finger
+                                           drag before that time, 0 to
+                                           always wait */
+    Bool stage_timing;          /* Count the stage latency histograms */
 
 } SynapticsParameters;
 
-struct _SynapticsPrivateRec {
-    SynapticsParameters synpara;        /* Default parameter settings, read from
-                                           the X config file */
-    struct SynapticsProtocolOperations *proto_ops;
-    void *proto_data;           /* protocol-specific data */
+/*
+ * Values derived from SynapticsParameters and the device dimensions, so the
+ * per-frame code doesn't recompute them. Rebuilt by
+ * SynapticsUpdateDerivedParameters() whenever either changes.
+ */
+typedef struct _SynapticsDerived {
+    double edge_center_x, edge_center_y;        /* center of the edges */
+    double edge_radius_x, edge_radius_y;        /* right/bottom edge to the
+                                                   center, <= 0 if the edges
+                                                   are degenerate */
+    double inv_resolution_horiz;        /* 1 / resolution_horiz */
+    double inv_resolution_vert;         /* 1 / resolution_vert */
+    double max_delta_sq;        /* maxDeltaMM squared */
+    double clickfinger_dist_x;  /* fingers closer than this count together */
+    double clickfinger_dist_y;  /* for clickfinger, 30% of the pad */
+    struct {
+        Bool valid;
+        int left, right, top, bottom;   /* inclusive, unset edges open */
+    } button_area[4];           /* indexed by SoftButtonAreas */
+    struct {
+        Bool valid;             /* FALSE if there is no row or its right and
+                                   middle buttons don't line up */
+        int top, bottom;        /* inclusive, unset edges open */
+    } button_row[2];            /* bottom and top row, SoftButtonAreas / 2 */
+} SynapticsDerivedRec;
 
+/* Limit for the per-frame part of SynapticsPrivateRec, 36 cache lines */
+#define SYNAPTICS_HOT_BYTES	(36 * 64)
+
+struct _SynapticsPrivateRec {
+    /*
+     * Per-frame state, read or written by HandleState for every hardware
+     * report. It is kept together at the start of the struct so a frame
+     * touches as few cache lines as possible, up to device it must fit in
+     * SYNAPTICS_HOT_BYTES. The state written on every frame comes first,
+     * then the configuration it reads.
+     */
     struct SynapticsHwState *hwState;
+    struct SynapticsHwState *local_hw_state;    /* used in place of local hw state variables */
+    struct CommData comm;
 
-    const char *device;         /* device node */
+    CARD32 deadlines[DEADLINE_COUNT];   /* expiry of each timeout, in
+                                           hardware time */
+    unsigned int pending_deadlines;     /* bit per pending entry in deadlines */
+    int report_interval;        /* measured time between two hardware reports
+                                   in us, 0 until known */
+    int report_outliers;        /* intervals in a row too long to count */
+    CARD32 last_report_millis;  /* time of the last hardware report */
+    Bool events_posted;         /* HandleState posted events */
     CARD32 timer_time;          /* when timer last fired */
     OsTimerPtr timer;           /* for up/down-button repeat, tap processing, etc */
-
-    struct CommData comm;
-
-    struct SynapticsHwState *local_hw_state;    /* used in place of local hw state variables */
+    unsigned long timer_fires;  /* times the timer went off */
+    unsigned long spurious_timer_fires; /* of those, the ones that changed
+                                           nothing */
 
     SynapticsMoveHistRec move_hist[SYNAPTICS_MOVE_HISTORY];     /* movement history */
     int hist_index;             /* Last added entry in move_hist[] */
+    int count_packet_finger;    /* packet counter with finger on the touchpad */
+    double finger_velocity;     /* Finger speed in units/ms, see estimate_velocity() */
+    double predict_x, predict_y;        /* Lead of the posted motion over the finger, see predict_motion() */
+    double predict_speed;       /* Finger speed the lead was last fit to */
+    double motion_rem_x, motion_rem_y;  /* Motion of less than a unit not
+                                           posted yet */
     int hyst_center_x;          /* center x of hysteresis */
     int hyst_center_y;          /* center y of hysteresis */
     struct {
@@ -268,20 +397,15 @@ struct _SynapticsPrivateRec {
         double delta_y;         /* accumulated vert scroll delta */
         double last_a;          /* last angle-scroll position */
         CARD32 last_millis;     /* time last scroll event posted */
+        int packets_this_scroll;        /* Events received for this scroll */
         double coast_speed_x;   /* Horizontal coasting speed in scrolls/s */
         double coast_speed_y;   /* Vertical coasting speed in scrolls/s */
         double coast_delta_x;   /* Accumulated horizontal coast delta */
         double coast_delta_y;   /* Accumulated vertical coast delta */
-        int packets_this_scroll;        /* Events received for this scroll */
     } scroll;
-    int count_packet_finger;    /* packet counter with finger on the touchpad */
-    int button_delay_millis;    /* button delay for 3rd button emulation */
-    Bool prev_up;               /* Previous up button value, for double click emulation */
-    enum FingerState finger_state;      /* previous finger state */
-    CARD32 last_motion_millis;  /* time of the last motion */
-    enum SoftButtonAreas last_button_area;    /* Last button area we were in */
-    int clickpad_click_millis;  /* Time of last clickpad click */
 
+    enum FingerState finger_state;      /* previous finger state */
+    enum MovingState moving_state;      /* previous moving state */
     enum TapState tap_state;    /* State of tap processing */
     int tap_max_fingers;        /* Max number of fingers seen since entering start state */
     int tap_button;             /* Which button started the tap processing */
@@ -296,7 +420,11 @@ struct _SynapticsPrivateRec {
 											 the user is only supposed to prolong the drag
 											 only with 3 fingers but not 1 or 2. 
 											 This is why we need to keep track of this timestamp. */
-    enum MovingState moving_state;      /* previous moving state */
+    CARD32 three_finger_start_millis;   /* Time TS_3FINGER_START was entered */
+    CARD32 last_motion_millis;  /* time of the last motion */
+    enum SoftButtonAreas last_button_area;    /* Last button area we were in */
+    int clickpad_click_millis;  /* Time of last clickpad click */
+    Bool prev_up;               /* Previous up button value, for double click emulation */
     Bool vert_scroll_edge_on;   /* Keeps track of currently active scroll modes */
     Bool horiz_scroll_edge_on;  /* Keeps track of currently active scroll modes */
     Bool vert_scroll_twofinger_on;      /* Keeps track of currently active scroll modes */
@@ -315,10 +443,53 @@ struct _SynapticsPrivateRec {
     int prev_z;                 /* previous z value, for palm detection */
     int prevFingers;            /* previous numFingers, for transition detection */
     int avg_width;              /* weighted average of previous fingerWidth values */
+    uint32_t open_slots;        /* Bit of each currently open touch slot */
+    SynapticsSlotPosRec *slot_pos;      /* Position of each slot in the last
+                                           frame, for centroid motion */
+
+    CARD64 stage_start[STAGE_COUNT];    /* when each stage began, in ns */
+    uint32_t stage_hist[STAGE_COUNT][STAGE_BUCKETS];    /* latency histogram
+                                                           of each stage */
+    int tap_drag_events;        /* entries used in tap_drag */
+    struct {
+        double dx, dy;
+    } tap_drag[SYNAPTICS_TAP_DRAG_EVENTS];      /* motion events posted in
+                                                   TS_3, for
+                                                   tap_and_drag_rollback */
+
+    /*
+     * Configuration and probe results read for every hardware report.
+     */
+    SynapticsParameters synpara;        /* Default parameter settings, read from
+                                           the X config file */
+    SynapticsDerivedRec derived;        /* Precomputed from synpara */
+    struct SynapticsProtocolOperations *proto_ops;
+    void *proto_data;           /* protocol-specific data */
 #ifndef NO_DRIVER_SCALING
     double horiz_coeff;         /* normalization factor for x coordintes */
     double vert_coeff;          /* normalization factor for y coordintes */
 #endif
+    int scroll_axis_horiz;      /* Horizontal smooth-scrolling axis */
+    int scroll_axis_vert;       /* Vertical smooth-scrolling axis */
+    ValuatorMask *scroll_events_mask;   /* ValuatorMask for smooth-scrolling */
+    ValuatorMask *motion_events_mask;   /* ValuatorMask for pointer motion */
+    Bool has_touch;             /* Device has multitouch capabilities */
+    int num_slots;              /* Number of touch slots allocated */
+    Bool has_scrollbuttons;     /* device has physical scrollbuttons */
+    Bool has_semi_mt;           /* device is only semi-multitouch capable */
+    Bool has_mt_palm_detect;    /* device reports per finger width and pressure */
+
+    /*
+     * Probe results and state that changes less than once a frame. device
+     * must stay the first of them, the hot part ends there.
+     */
+    const char *device;         /* device node */
+    SynapticsTraceRec trace[SYNAPTICS_TRACE_SIZE];      /* ring of state
+                                                           changes */
+    uint32_t trace_head;        /* records ever written to trace, published
+                                   after the record */
+
+    int button_delay_millis;    /* button delay for 3rd button emulation */
 
     int minx, maxx, miny, maxy; /* min/max dimensions as detected */
     int minp, maxp, minw, maxw; /* min/max pressure and finger width as detected */
@@ -330,25 +501,14 @@ struct _SynapticsPrivateRec {
     Bool has_triple;            /* triple click detected for this device */
     Bool has_pressure;          /* device reports pressure */
     Bool has_width;             /* device reports finger width */
-    Bool has_scrollbuttons;     /* device has physical scrollbuttons */
-    Bool has_semi_mt;           /* device is only semi-multitouch capable */
-    Bool has_mt_palm_detect;    /* device reports per finger width and pressure */
 
     enum TouchpadModel model;   /* The detected model */
     unsigned short id_vendor;   /* vendor id */
     unsigned short id_product;  /* product id */
 
-    int scroll_axis_horiz;      /* Horizontal smooth-scrolling axis */
-    int scroll_axis_vert;       /* Vertical smooth-scrolling axis */
-    ValuatorMask *scroll_events_mask;   /* ValuatorMask for smooth-scrolling */
-
-    Bool has_touch;             /* Device has multitouch capabilities */
     int max_touches;            /* Number of touches supported */
     int num_mt_axes;            /* Number of multitouch axes other than X, Y */
     SynapticsTouchAxisRec *touch_axes;  /* Touch axis information other than X, Y */
-    int num_slots;              /* Number of touch slots allocated */
-    int *open_slots;            /* Array of currently open touch slots */
-    int num_active_touches;     /* Number of active touches on device */
 };
 
 #endif                          /* _SYNAPTICSSTR_H_ */
@@ -21,42 +21,35 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <strings.h>
+
 #include "synproto.h"
 #include "synapticsstr.h"
 
 static int
 HwStateAllocTouch(struct SynapticsHwState *hw, SynapticsPrivate * priv)
 {
-    int num_vals;
-    int i = 0;
-
-    hw->num_mt_mask = priv->num_slots;
-    hw->mt_mask = malloc(hw->num_mt_mask * sizeof(ValuatorMask *));
-    if (!hw->mt_mask)
-        goto fail;
-
-    num_vals = 2;               /* x and y */
-    num_vals += 2;              /* scroll axes */
-    num_vals += priv->num_mt_axes;
-
-    for (; i < hw->num_mt_mask; i++) {
-        hw->mt_mask[i] = valuator_mask_new(num_vals);
-        if (!hw->mt_mask[i])
-            goto fail;
+    int n = priv->num_slots;
+
+    hw->num_slots = n;
+    if (!n)
+        return Success;
+
+    hw->slot_x = calloc(4 * n, sizeof(int));
+    hw->slot_state = calloc(n, sizeof(enum SynapticsSlotState));
+    if (!hw->slot_x || !hw->slot_state) {
+        free(hw->slot_x);
+        free(hw->slot_state);
+        hw->slot_x = NULL;
+        hw->slot_state = NULL;
+        return BadAlloc;
     }
 
-    hw->slot_state = calloc(hw->num_mt_mask, sizeof(enum SynapticsSlotState));
-    if (!hw->slot_state)
-        goto fail;
+    hw->slot_y = hw->slot_x + n;
+    hw->slot_pressure = hw->slot_y + n;
+    hw->slot_touch_major = hw->slot_pressure + n;
 
     return Success;
-
- fail:
-    for (i--; i >= 0; i--)
-        valuator_mask_free(&hw->mt_mask[i]);
-    free(hw->mt_mask);
-    hw->mt_mask = NULL;
-    return BadAlloc;
 }
 
 struct SynapticsHwState *
@@ -79,24 +72,27 @@ SynapticsHwStateAlloc(SynapticsPrivate * priv)
 void
 SynapticsHwStateFree(struct SynapticsHwState **hw)
 {
-    int i;
-
     if (!*hw)
         return;
 
     free((*hw)->slot_state);
-    for (i = 0; i < (*hw)->num_mt_mask; i++)
-        valuator_mask_free(&(*hw)->mt_mask[i]);
-    free((*hw)->mt_mask);
+    free((*hw)->slot_x);
 
     free(*hw);
     *hw = NULL;
 }
 
+/*
+ * Only the values of dirty slots are copied. The states copied between
+ * each other are at most one frame apart, so a slot that is clean in both
+ * the source and the destination has the same values in both.
+ */
 void
 SynapticsCopyHwState(struct SynapticsHwState *dst,
                      const struct SynapticsHwState *src)
 {
+    int n = dst->num_slots < src->num_slots ? dst->num_slots : src->num_slots;
+    uint32_t dirty = src->dirty_slots | dst->dirty_slots;
     int i;
 
     dst->millis = src->millis;
@@ -113,10 +109,17 @@ SynapticsCopyHwState(struct SynapticsHwState *dst,
     dst->down = src->down;
     memcpy(dst->multi, src->multi, sizeof(dst->multi));
     dst->middle = src->middle & BTN_EMULATED_FLAG ? 0 : src->middle;
-    for (i = 0; i < dst->num_mt_mask && i < src->num_mt_mask; i++)
-        valuator_mask_copy(dst->mt_mask[i], src->mt_mask[i]);
-    memcpy(dst->slot_state, src->slot_state,
-           dst->num_mt_mask * sizeof(enum SynapticsSlotState));
+    while (dirty && (i = ffs(dirty) - 1) < n) {
+        dirty &= dirty - 1;
+        dst->slot_x[i] = src->slot_x[i];
+        dst->slot_y[i] = src->slot_y[i];
+        dst->slot_pressure[i] = src->slot_pressure[i];
+        dst->slot_touch_major[i] = src->slot_touch_major[i];
+    }
+    if (n > 0)
+        memcpy(dst->slot_state, src->slot_state,
+               n * sizeof(enum SynapticsSlotState));
+    dst->dirty_slots = src->dirty_slots;
 }
 
 void
@@ -142,18 +145,18 @@ SynapticsResetHwState(struct SynapticsHwState *hw)
     SynapticsResetTouchHwState(hw, TRUE);
 }
 
+/*
+ * Start a new frame. No slot has changed in it yet.
+ */
 void
 SynapticsResetTouchHwState(struct SynapticsHwState *hw, Bool set_slot_empty)
 {
     int i;
 
-    for (i = 0; i < hw->num_mt_mask; i++) {
-        int j;
-
-        /* Leave x and y valuators in case we need to restart touch */
-        for (j = 2; j < valuator_mask_num_valuators(hw->mt_mask[i]); j++)
-            valuator_mask_unset(hw->mt_mask[i], j);
+    hw->dirty_slots = 0;
 
+    /* The slot values are kept in case we need to restart touch */
+    for (i = 0; i < hw->num_slots; i++) {
         switch (hw->slot_state[i]) {
         case SLOTSTATE_OPEN:
         case SLOTSTATE_OPEN_EMPTY:
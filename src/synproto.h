@@ -77,9 +77,16 @@ struct SynapticsHwState {
     Bool multi[8];
     Bool middle;                /* Some ALPS touchpads have a middle button */
 
-    int num_mt_mask;
-    ValuatorMask **mt_mask;
+    /* Multitouch slots, one entry per slot in each array. The values are
+     * the last ones the slot reported, the arrays share one allocation. */
+    int num_slots;
+    int *slot_x;
+    int *slot_y;
+    int *slot_pressure;
+    int *slot_touch_major;
     enum SynapticsSlotState *slot_state;
+    uint32_t dirty_slots;       /* bit of each slot whose values changed
+                                   in this frame, see SynapticsCopyHwState */
 };
 
 struct CommData {
@@ -131,5 +138,6 @@ extern void SynapticsResetTouchHwState(struct SynapticsHwState *hw,
                                        Bool set_slot_empty);
 
 extern Bool SynapticsIsSoftButtonAreasValid(int *values);
+extern void SynapticsUpdateDerivedParameters(SynapticsPrivate * priv);
 
 #endif                          /* _SYNPROTO_H_ */
@@ -0,0 +1,209 @@
+/*
+ * Transition table of the tap and drag state machine, see tapndrag.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include "tapndrag.h"
+
+#define ROW(state, all, none, action, next, flags) \
+    { state, all, none, action, next, flags }
+#define DO(state, all, none, action) \
+    { state, all, none, action, state, TR_STAY }
+
+const struct TapTransition tap_transitions[] = {
+    ROW(TS_START, TI_TOUCH | TI_3FINGERS, 0, TA_NONE, TS_3FINGER_START, 0),
+    ROW(TS_START, TI_TOUCH, 0, TA_NONE, TS_1, 0),
+
+    ROW(TS_1, TI_CLICKPAD | TI_PRESS, 0, TA_NONE, TS_CLICKPAD_MOVE,
+        TR_RESTART),
+    DO(TS_1, TI_2F_SCROLL, 0, TA_NOTE_SCROLL),
+    ROW(TS_1, TI_3FINGERS, 0, TA_NONE, TS_3FINGER_START, 0),
+    ROW(TS_1, TI_MOVE, 0, TA_MOVE, TS_MOVE, TR_RESTART),
+    ROW(TS_1, TI_TIMEOUT | TI_TOUCHED, 0, TA_MOVE, TS_MOVE, TR_RESTART),
+    ROW(TS_1, TI_TIMEOUT, 0, TA_NONE, TS_MOVE, TR_RESTART),
+    ROW(TS_1, TI_RELEASE, 0, TA_SELECT_BUTTON, TS_2A, 0),
+
+    ROW(TS_MOVE, TI_CLICKPAD | TI_PRESS, 0, TA_NONE, TS_CLICKPAD_MOVE,
+        TR_RESTART),
+    ROW(TS_MOVE, TI_3FINGERS, 0, TA_3FD_JOIN, TS_DRAG, 0),
+    ROW(TS_MOVE, TI_RELEASE, 0, TA_STOP, TS_START, 0),
+
+    ROW(TS_2A, TI_TOUCH, 0, TA_NONE, TS_3, 0),
+    ROW(TS_2A, TI_TIMEOUT, 0, TA_NONE, TS_SINGLETAP, 0),
+
+    ROW(TS_2B, TI_TOUCH, 0, TA_NONE, TS_3, 0),
+    ROW(TS_2B, TI_TIMEOUT, 0, TA_NONE, TS_SINGLETAP, 0),
+
+    ROW(TS_SINGLETAP, TI_TOUCH, 0, TA_NONE, TS_1, 0),
+    ROW(TS_SINGLETAP, TI_TIMEOUT, 0, TA_NONE, TS_START, 0),
+
+    ROW(TS_3, TI_MOVE | TI_TAP_AND_DRAG, 0, TA_MOVE, TS_DRAG, TR_RESTART),
+    ROW(TS_3, TI_MOVE, 0, TA_NONE, TS_1, TR_RESTART),
+    ROW(TS_3, TI_TIMEOUT | TI_TAP_AND_DRAG | TI_TOUCHED, 0, TA_MOVE, TS_DRAG,
+        TR_RESTART),
+    ROW(TS_3, TI_TIMEOUT | TI_TAP_AND_DRAG, 0, TA_NONE, TS_DRAG, TR_RESTART),
+    ROW(TS_3, TI_TIMEOUT, 0, TA_NONE, TS_1, TR_RESTART),
+    ROW(TS_3, TI_RELEASE, 0, TA_NONE, TS_2B, 0),
+
+    ROW(TS_DRAG, TI_CLICKPAD | TI_PRESS, 0, TA_NONE, TS_CLICKPAD_MOVE,
+        TR_RESTART),
+    DO(TS_DRAG, TI_3FD | TI_3FINGERS, 0, TA_3FD_HOLD),
+    ROW(TS_DRAG, TI_3FD_LAPSED, 0, TA_3FD_STOP, TS_MOVE, 0),
+    DO(TS_DRAG, TI_MOVE, 0, TA_MOVE),
+    ROW(TS_DRAG, TI_RELEASE | TI_LOCKED, 0, TA_STOP, TS_4, 0),
+    ROW(TS_DRAG, TI_RELEASE, 0, TA_STOP, TS_START, 0),
+
+    ROW(TS_4, TI_TIMEOUT, 0, TA_3FD_END, TS_START, TR_RESTART),
+    ROW(TS_4, TI_TOUCH, 0, TA_NONE, TS_5, 0),
+
+    ROW(TS_5, TI_TIMEOUT, 0, TA_NONE, TS_DRAG, TR_RESTART),
+    ROW(TS_5, TI_MOVE, 0, TA_NONE, TS_DRAG, TR_RESTART),
+    ROW(TS_5, TI_RELEASE, 0, TA_STOP_DRAG, TS_START, 0),
+
+    DO(TS_CLICKPAD_MOVE, 0, 0, TA_CLICKPAD_HOLD),
+    ROW(TS_CLICKPAD_MOVE, 0, TI_PRESS, TA_CLICKPAD_RELEASE, TS_MOVE, 0),
+
+    ROW(TS_3FINGER_START, TI_CLICKPAD | TI_PRESS, 0, TA_NONE,
+        TS_CLICKPAD_MOVE, TR_RESTART),
+    ROW(TS_3FINGER_START, TI_RELEASE, 0, TA_3FD_TAP, TS_SINGLETAP, 0),
+    ROW(TS_3FINGER_START, TI_TIMEOUT, 0, TA_3FD_START, TS_DRAG, 0),
+    ROW(TS_3FINGER_START, TI_3FD_MOVING, 0, TA_3FD_START, TS_DRAG, 0),
+};
+
+const int tap_num_transitions =
+    sizeof(tap_transitions) / sizeof(tap_transitions[0]);
+
+const char *const tap_state_names[TAP_STATE_COUNT] = {
+    "START", "1", "MOVE", "2A", "2B", "SINGLETAP", "3", "DRAG", "4", "5",
+    "CLICKPAD_MOVE", "3FINGER_START",
+};
+
+const char *const tap_input_names[TAP_INPUT_COUNT] = {
+    "touch", "release", "move", "timeout", "press", "clickpad", "touched",
+    "3fingers", "2f_scroll", "tap_and_drag", "locked", "3fd", "3fd_moving",
+    "3fd_lapsed",
+};
+
+const char *const tap_action_names[TAP_ACTION_COUNT] = {
+    "", "move", "stop", "stop_drag", "select_button", "note_scroll",
+    "3fd_tap", "3fd_start", "3fd_join", "3fd_hold", "3fd_stop", "3fd_end",
+    "clickpad_hold", "clickpad_release",
+};
+
+int tap_state_rows[TAP_STATE_COUNT + 1];
+
+#ifdef DEBUG
+static char table_error[128];
+
+/* TRUE if a TR_RESTART path from state leads back to a state on the path */
+static Bool
+restart_cycle(int state, int *visiting)
+{
+    int i;
+
+    if (visiting[state])
+        return TRUE;
+
+    visiting[state] = 1;
+    for (i = tap_state_rows[state]; i < tap_state_rows[state + 1]; i++) {
+        const struct TapTransition *t = &tap_transitions[i];
+
+        if ((t->flags & TR_RESTART) && !(t->flags & TR_STAY) &&
+            restart_cycle(t->next, visiting))
+            return TRUE;
+    }
+    visiting[state] = 0;
+
+    return FALSE;
+}
+
+static const char *
+check_table(void)
+{
+    Bool reached[TAP_STATE_COUNT] = { FALSE };
+    int visiting[TAP_STATE_COUNT] = { 0 };
+    int i, j;
+
+    for (i = 0; i < tap_num_transitions; i++) {
+        const struct TapTransition *t = &tap_transitions[i];
+
+        if (t->state < 0 || t->state >= TAP_STATE_COUNT ||
+            t->next < 0 || t->next >= TAP_STATE_COUNT ||
+            t->action < 0 || t->action >= TAP_ACTION_COUNT) {
+            snprintf(table_error, sizeof(table_error),
+                     "row %d is out of range", i);
+            return table_error;
+        }
+        if (i > 0 && t->state < tap_transitions[i - 1].state) {
+            snprintf(table_error, sizeof(table_error),
+                     "row %d is not sorted by state", i);
+            return table_error;
+        }
+        if (t->all & t->none) {
+            snprintf(table_error, sizeof(table_error),
+                     "row %d can never apply", i);
+            return table_error;
+        }
+        if (!(t->flags & TR_STAY))
+            reached[t->next] = TRUE;
+
+        /* a row that applies whenever a later one does hides it */
+        for (j = i + 1; !(t->flags & TR_STAY) && j < tap_num_transitions &&
+             tap_transitions[j].state == t->state; j++) {
+            const struct TapTransition *u = &tap_transitions[j];
+
+            if ((t->all & u->all) == t->all && (t->none & u->none) == t->none) {
+                snprintf(table_error, sizeof(table_error),
+                         "row %d is hidden by row %d", j, i);
+                return table_error;
+            }
+        }
+    }
+
+    for (i = 0; i < TAP_STATE_COUNT; i++) {
+        if (tap_state_rows[i] == tap_state_rows[i + 1]) {
+            snprintf(table_error, sizeof(table_error),
+                     "state %s has no rows", tap_state_names[i]);
+            return table_error;
+        }
+        if (i != TS_START && !reached[i]) {
+            snprintf(table_error, sizeof(table_error),
+                     "state %s is unreachable", tap_state_names[i]);
+            return table_error;
+        }
+        if (restart_cycle(i, visiting)) {
+            snprintf(table_error, sizeof(table_error),
+                     "restarts from state %s loop", tap_state_names[i]);
+            return table_error;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+Bool
+TapTableInit(const char **error)
+{
+    int state, i = 0;
+
+    for (state = 0; state <= TAP_STATE_COUNT; state++) {
+        while (i < tap_num_transitions && tap_transitions[i].state < state)
+            i++;
+        tap_state_rows[state] = i;
+    }
+    tap_state_rows[TAP_STATE_COUNT] = tap_num_transitions;
+
+#ifdef DEBUG
+    *error = check_table();
+    return *error == NULL;
+#else
+    *error = NULL;
+    return TRUE;
+#endif
+}
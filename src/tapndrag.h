@@ -0,0 +1,108 @@
+/*
+ * Transition table of the tap and drag state machine.
+ *
+ * HandleTapProcessing reduces each frame to a set of TapInput bits and
+ * walks the rows of the current state in order. A row applies if all bits
+ * in "all" and none in "none" are set. Its action runs, then the machine
+ * moves to "next". TR_RESTART evaluates the new state on the same frame,
+ * TR_STAY rows only run their action and the walk continues with the next
+ * row. Rows are sorted by state.
+ *
+ * The table is plain data so tools can use it without the driver,
+ * bench/tapgraph generates docs/tapndrag.dia from it.
+ */
+
+#ifndef _TAPNDRAG_H_
+#define _TAPNDRAG_H_
+
+#include "synapticsstr.h"
+
+#define TAP_STATE_COUNT (TS_3FINGER_START + 1)
+
+/* Bit numbers of the TapInput bits, in the order of tap_input_names */
+enum TapInputBit {
+    TIB_TOUCH,
+    TIB_RELEASE,
+    TIB_MOVE,
+    TIB_TIMEOUT,
+    TIB_PRESS,
+    TIB_CLICKPAD,
+    TIB_TOUCHED,
+    TIB_3FINGERS,
+    TIB_2F_SCROLL,
+    TIB_TAP_AND_DRAG,
+    TIB_LOCKED,
+    TIB_3FD,
+    TIB_3FD_MOVING,
+    TIB_3FD_LAPSED,
+    TAP_INPUT_COUNT
+};
+
+enum TapInput {
+    TI_TOUCH = 1 << TIB_TOUCH,          /* finger went down */
+    TI_RELEASE = 1 << TIB_RELEASE,      /* finger went up */
+    TI_MOVE = 1 << TIB_MOVE,            /* moved TapMove from the touch */
+    TI_TIMEOUT = 1 << TIB_TIMEOUT,      /* timeout of the state expired */
+    TI_PRESS = 1 << TIB_PRESS,          /* a physical button is down */
+    TI_CLICKPAD = 1 << TIB_CLICKPAD,    /* the device is a clickpad */
+    TI_TOUCHED = 1 << TIB_TOUCHED,      /* finger is FS_TOUCHED */
+    TI_3FINGERS = 1 << TIB_3FINGERS,    /* three fingers on the pad */
+    TI_2F_SCROLL = 1 << TIB_2F_SCROLL,  /* two fingers moved with two-finger
+                                           scrolling enabled */
+    TI_TAP_AND_DRAG = 1 << TIB_TAP_AND_DRAG,    /* TapAndDragGesture is on */
+    TI_LOCKED = 1 << TIB_LOCKED,        /* the drag stays on after release,
+                                           locked drags or 3-finger drag */
+    TI_3FD = 1 << TIB_3FD,              /* in a 3-finger drag */
+    TI_3FD_MOVING = 1 << TIB_3FD_MOVING,        /* 3 fingers started moving,
+                                                   see three_finger_drag_moving */
+    TI_3FD_LAPSED = 1 << TIB_3FD_LAPSED,        /* fewer than 3 fingers for
+                                                   longer than LockedDragTimeout
+                                                   in a 3-finger drag */
+};
+
+enum TapAction {
+    TA_NONE,
+    TA_MOVE,                    /* start moving the pointer */
+    TA_STOP,                    /* stop moving the pointer */
+    TA_STOP_DRAG,               /* stop moving and end a 3-finger drag */
+    TA_SELECT_BUTTON,           /* choose the button of the tap */
+    TA_NOTE_SCROLL,             /* no tap after a two-finger scroll */
+    TA_3FD_TAP,                 /* 3-finger tap, button 2 */
+    TA_3FD_START,               /* start a 3-finger drag */
+    TA_3FD_JOIN,                /* 3 fingers while moving, start dragging */
+    TA_3FD_HOLD,                /* 3 fingers still down in a 3-finger drag */
+    TA_3FD_STOP,                /* release the drag button */
+    TA_3FD_END,                 /* 3-finger drag is over */
+    TA_CLICKPAD_HOLD,           /* button held down on a clickpad */
+    TA_CLICKPAD_RELEASE,        /* button released on a clickpad */
+    TAP_ACTION_COUNT
+};
+
+#define TR_RESTART      (1 << 0)
+#define TR_STAY         (1 << 1)
+
+struct TapTransition {
+    enum TapState state;
+    unsigned int all;           /* TapInput bits that must be set */
+    unsigned int none;          /* TapInput bits that must be clear */
+    enum TapAction action;
+    enum TapState next;         /* unused with TR_STAY */
+    unsigned int flags;
+};
+
+extern const struct TapTransition tap_transitions[];
+extern const int tap_num_transitions;
+
+extern const char *const tap_state_names[TAP_STATE_COUNT];
+extern const char *const tap_input_names[TAP_INPUT_COUNT];
+extern const char *const tap_action_names[TAP_ACTION_COUNT];
+
+/* First row of each state, the rows of state s are
+ * tap_state_rows[s] .. tap_state_rows[s + 1] - 1 */
+extern int tap_state_rows[TAP_STATE_COUNT + 1];
+
+/* Build tap_state_rows. Also checks the table if DEBUG is defined, returns
+ * FALSE with the first problem in *error if it is inconsistent. */
+extern Bool TapTableInit(const char **error);
+
+#endif                          /* _TAPNDRAG_H_ */
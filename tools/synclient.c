@@ -53,6 +53,10 @@
 #define SBR_MIN 10
 #define SBR_MAX 1000
 
+/* Layout of the Synaptics Stage Latency property */
+#define STAGE_BUCKETS 16
+#define STAGE_BUCKET_MIN_NS 128
+
 union flong {                   /* Xlibs 64-bit property handling madness */
     long l;
     float f;
@@ -138,7 +142,10 @@ static struct Parameter params[] = {
     {"AreaBottomEdge",        PT_INT,    0, 10000, SYNAPTICS_PROP_AREA,	32,	3},
     {"HorizHysteresis",       PT_INT,    0, 10000, SYNAPTICS_PROP_NOISE_CANCELLATION, 32,	0},
     {"VertHysteresis",        PT_INT,    0, 10000, SYNAPTICS_PROP_NOISE_CANCELLATION, 32,	1},
+    {"ThreeFingerDragDelay",  PT_INT,    0, 10000, SYNAPTICS_PROP_THREE_FINGER_DRAG,	32,	0},
+    {"ThreeFingerDragCommitMove", PT_INT, 0, 10000, SYNAPTICS_PROP_THREE_FINGER_DRAG,	32,	1},
     {"ClickPad",              PT_BOOL,   0, 1,     SYNAPTICS_PROP_CLICKPAD,	8,	0},
+    {"StageTiming",           PT_BOOL,   0, 1,     SYNAPTICS_PROP_STAGE_TIMING,	8,	0},
     {"RightButtonAreaLeft",   PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_SOFTBUTTON_AREAS,	32,	0},
     {"RightButtonAreaRight",  PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_SOFTBUTTON_AREAS,	32,	1},
     {"RightButtonAreaTop",    PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_SOFTBUTTON_AREAS,	32,	2},
@@ -465,11 +472,153 @@ dp_show_settings(Display * dpy, XDevice * dev)
     }
 }
 
+/* Rows of the Synaptics Stage Latency property */
+static const char *stage_names[] = {
+    "read", "frame", "state", "tap", "scroll", "deltas", "post", "timer",
+};
+
+#define NUM_STAGES (sizeof(stage_names) / sizeof(stage_names[0]))
+
+static void
+dp_show_stage_latency(Display * dpy, XDevice * dev)
+{
+    Atom prop, type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data;
+    long *counts;
+    int bucket, stage;
+
+    prop = XInternAtom(dpy, SYNAPTICS_PROP_STAGE_LATENCY, True);
+    if (!prop) {
+        fprintf(stderr, "Stage latency not available.\n");
+        return;
+    }
+
+    XGetDeviceProperty(dpy, dev, prop, 0, NUM_STAGES * STAGE_BUCKETS, False,
+                       XA_CARDINAL, &type, &format, &nitems, &bytes_after,
+                       &data);
+    if (type != XA_CARDINAL || format != 32 ||
+        nitems != NUM_STAGES * STAGE_BUCKETS) {
+        fprintf(stderr, "Stage latency not available.\n");
+        if (type != None)
+            XFree(data);
+        return;
+    }
+
+    counts = (long *) data;
+    printf("Stage latency (number of times each stage took that long):\n");
+    printf("    %-10s", "");
+    for (stage = 0; stage < NUM_STAGES; stage++)
+        printf(" %9s", stage_names[stage]);
+    printf("\n");
+    for (bucket = 0; bucket < STAGE_BUCKETS; bucket++) {
+        double ns = (double) (STAGE_BUCKET_MIN_NS / 2) * (1 << bucket);
+        char label[16];
+
+        if (bucket == 0)
+            snprintf(label, sizeof(label), "< %dns", STAGE_BUCKET_MIN_NS);
+        else if (ns < 1000)
+            snprintf(label, sizeof(label), "%s%.0fns",
+                     bucket == STAGE_BUCKETS - 1 ? ">= " : "", ns);
+        else if (ns < 1000000)
+            snprintf(label, sizeof(label), "%s%.1fus",
+                     bucket == STAGE_BUCKETS - 1 ? ">= " : "", ns / 1000);
+        else
+            snprintf(label, sizeof(label), "%s%.1fms",
+                     bucket == STAGE_BUCKETS - 1 ? ">= " : "", ns / 1000000);
+
+        printf("    %-10s", label);
+        for (stage = 0; stage < NUM_STAGES; stage++)
+            printf(" %9lu",
+                   (unsigned long) counts[stage * STAGE_BUCKETS + bucket]);
+        printf("\n");
+    }
+
+    XFree(data);
+}
+
+static void
+dp_reset_stage_latency(Display * dpy, XDevice * dev)
+{
+    long zeros[NUM_STAGES * STAGE_BUCKETS] = { 0 };
+    Atom prop;
+
+    prop = XInternAtom(dpy, SYNAPTICS_PROP_STAGE_LATENCY, True);
+    if (!prop) {
+        fprintf(stderr, "Stage latency not available.\n");
+        return;
+    }
+
+    XChangeDeviceProperty(dpy, dev, prop, XA_CARDINAL, 32, PropModeReplace,
+                          (unsigned char *) zeros, NUM_STAGES * STAGE_BUCKETS);
+    XFlush(dpy);
+}
+
+/* Tap states in the Synaptics State Trace property, see tapndrag.c */
+static const char *tap_state_names[] = {
+    "START", "1", "MOVE", "2A", "2B", "SINGLETAP", "3", "DRAG", "4", "5",
+    "CLICKPAD_MOVE", "3FINGER_START",
+};
+
+#define NUM_TAP_STATES (sizeof(tap_state_names) / sizeof(tap_state_names[0]))
+
+static const char *
+tap_state_name(unsigned int state)
+{
+    return state < NUM_TAP_STATES ? tap_state_names[state] : "?";
+}
+
+static void
+dp_show_state_trace(Display * dpy, XDevice * dev)
+{
+    Atom prop, type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data;
+    long *records;
+    unsigned long i;
+
+    prop = XInternAtom(dpy, SYNAPTICS_PROP_STATE_TRACE, True);
+    if (!prop) {
+        fprintf(stderr, "State trace not available.\n");
+        return;
+    }
+
+    XGetDeviceProperty(dpy, dev, prop, 0, 1000, False, XA_CARDINAL, &type,
+                       &format, &nitems, &bytes_after, &data);
+    if (type != XA_CARDINAL || format != 32) {
+        fprintf(stderr, "State trace not available.\n");
+        if (type != None)
+            XFree(data);
+        return;
+    }
+
+    records = (long *) data;
+    printf("State trace (time, tap state, fingers, moving, 3-finger drag):\n");
+    for (i = 0; i + 1 < nitems; i += 2) {
+        unsigned long state = records[i + 1];
+
+        printf("    %10lu  %13s -> %-13s  %lu  %-8s %s\n",
+               (unsigned long) records[i] & 0xffffffff,
+               tap_state_name(state & 0xff),
+               tap_state_name((state >> 8) & 0xff),
+               (state >> 16) & 0xff,
+               ((state >> 24) & 0x7f) ? "moving" : "-",
+               (state & (1UL << 31)) ? "drag" : "-");
+    }
+
+    XFree(data);
+}
+
 static void
 usage(void)
 {
-    fprintf(stderr, "Usage: synclient [-h] [-l] [-V] [-?] [var1=value1 [var2=value2] ...]\n");
+    fprintf(stderr, "Usage: synclient [-h] [-l] [-s] [-z] [-t] [-V] [-?] [var1=value1 [var2=value2] ...]\n");
     fprintf(stderr, "  -l List current user settings\n");
+    fprintf(stderr, "  -s Show the latency histograms of the driver's stages\n");
+    fprintf(stderr, "  -z Reset the latency histograms\n");
+    fprintf(stderr, "  -t Show the driver's last tap and moving state changes\n");
     fprintf(stderr, "  -V Print synclient version string and exit\n");
     fprintf(stderr, "  -? Show this help message\n");
     fprintf(stderr, "  var=value  Set user parameter 'var' to 'value'.\n");
@@ -481,6 +630,9 @@ main(int argc, char *argv[])
 {
     int c;
     int dump_settings = 0;
+    int show_latency = 0;
+    int reset_latency = 0;
+    int show_trace = 0;
     int first_cmd;
 
     Display *dpy;
@@ -490,11 +642,20 @@ main(int argc, char *argv[])
         dump_settings = 1;
 
     /* Parse command line parameters */
-    while ((c = getopt(argc, argv, "lV?")) != -1) {
+    while ((c = getopt(argc, argv, "lsztV?")) != -1) {
         switch (c) {
         case 'l':
             dump_settings = 1;
             break;
+        case 's':
+            show_latency = 1;
+            break;
+        case 'z':
+            reset_latency = 1;
+            break;
+        case 't':
+            show_trace = 1;
+            break;
         case 'V':
             printf("%s\n", VERSION);
             exit(0);
@@ -505,7 +666,8 @@ main(int argc, char *argv[])
     }
 
     first_cmd = optind;
-    if (!dump_settings && first_cmd == argc)
+    if (!dump_settings && !show_latency && !reset_latency && !show_trace &&
+        first_cmd == argc)
         usage();
 
     dpy = dp_init();
@@ -515,6 +677,12 @@ main(int argc, char *argv[])
     dp_set_variables(dpy, dev, argc, argv, first_cmd);
     if (dump_settings)
         dp_show_settings(dpy, dev);
+    if (show_latency)
+        dp_show_stage_latency(dpy, dev);
+    if (reset_latency)
+        dp_reset_stage_latency(dpy, dev);
+    if (show_trace)
+        dp_show_state_trace(dpy, dev);
 
     XCloseDevice(dpy, dev);
     XCloseDisplay(dpy);
@@ -31,16 +31,29 @@
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/XInput.h>
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+#include <X11/extensions/XInput2.h>
+#endif                          /* HAVE_X11_EXTENSIONS_XINPUT2_H */
 #ifdef HAVE_X11_EXTENSIONS_RECORD_H
 #include <X11/Xproto.h>
 #include <X11/extensions/record.h>
 #endif                          /* HAVE_X11_EXTENSIONS_RECORD_H */
+#ifdef BUILD_EVENTCOMM
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <libevdev/libevdev.h>
+#endif                          /* BUILD_EVENTCOMM */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <sys/stat.h>
@@ -72,6 +85,10 @@ static enum TouchpadState previous_state;
 static enum TouchpadState disable_state = TouchpadOff;
 static int verbose;
 
+/* Calls of toggle_touchpad() that didn't change the state and so didn't
+ * write the property */
+static unsigned long suppressed_writes;
+
 #define KEYMAP_SIZE 32
 static unsigned char keyboard_mask[KEYMAP_SIZE];
 
@@ -83,7 +100,8 @@ usage(void)
     fprintf(stderr,
             "  -i How many seconds to wait after the last key press before\n");
     fprintf(stderr, "     enabling the touchpad. (default is 2.0s)\n");
-    fprintf(stderr, "  -m How many milli-seconds to wait until next poll.\n");
+    fprintf(stderr, "  -m How many milli-seconds to wait until next poll, if the\n");
+    fprintf(stderr, "     server has no XInput 2 raw key events.\n");
     fprintf(stderr, "     (default is 200ms)\n");
     fprintf(stderr, "  -d Start as a daemon, i.e. in the background.\n");
     fprintf(stderr, "  -p Create a pid file with the specified name.\n");
@@ -93,6 +111,9 @@ usage(void)
             "  -k Ignore modifier keys when monitoring keyboard activity.\n");
     fprintf(stderr, "  -K Like -k but also ignore Modifier+Key combos.\n");
     fprintf(stderr, "  -R Use the XRecord extension.\n");
+#ifdef BUILD_EVENTCOMM
+    fprintf(stderr, "  -E Read the keyboards' event devices directly.\n");
+#endif
     fprintf(stderr, "  -v Print diagnostic messages.\n");
     fprintf(stderr, "  -? Show this help message.\n");
     exit(1);
@@ -116,6 +137,10 @@ store_current_touchpad_state(void)
 
 /**
  * Toggle touchpad enabled/disabled state, decided by value.
+ *
+ * The main loops call this for every key event or poll, pad_disabled
+ * caches what was last written so the property is only written, and the
+ * server only asked for its current value, when the state changes.
  */
 static void
 toggle_touchpad(Bool enable)
@@ -126,7 +151,8 @@ toggle_touchpad(Bool enable)
         data = previous_state;
         pad_disabled = False;
         if (verbose)
-            printf("Enable\n");
+            printf("Enable (%lu redundant writes suppressed)\n",
+                   suppressed_writes);
     }
     else if (!pad_disabled && !enable &&
              previous_state != disable_state && previous_state != TouchpadOff) {
@@ -134,10 +160,13 @@ toggle_touchpad(Bool enable)
         pad_disabled = True;
         data = disable_state;
         if (verbose)
-            printf("Disable\n");
+            printf("Disable (%lu redundant writes suppressed)\n",
+                   suppressed_writes);
     }
-    else
+    else {
+        suppressed_writes++;
         return;
+    }
 
     /* This potentially overwrites a different client's setting, but ... */
     XChangeDeviceProperty(display, dev, touchpad_off_prop, XA_INTEGER, 8,
@@ -187,16 +216,14 @@ install_signal_handler(void)
     }
 }
 
+/* Compare the keys down now with those down last time */
 static enum KeyboardActivity
-keyboard_activity(Display * display)
+keymap_activity(const unsigned char *key_state)
 {
     static unsigned char old_key_state[KEYMAP_SIZE];
-    unsigned char key_state[KEYMAP_SIZE];
     int i;
     int ret = ActivityNone;
 
-    XQueryKeymap(display, (char *) key_state);
-
     for (i = 0; i < KEYMAP_SIZE; i++) {
         if ((key_state[i] & ~old_key_state[i]) & keyboard_mask[i]) {
             ret = ActivityNew;
@@ -219,6 +246,16 @@ keyboard_activity(Display * display)
     return ret;
 }
 
+static enum KeyboardActivity
+keyboard_activity(Display * display)
+{
+    unsigned char key_state[KEYMAP_SIZE];
+
+    XQueryKeymap(display, (char *) key_state);
+
+    return keymap_activity(key_state);
+}
+
 static double
 get_time(void)
 {
@@ -296,6 +333,377 @@ setup_keyboard_mask(Display * display, int ignore_modifier_keys)
     }
 }
 
+/* ---- the following code is for using XInput 2 raw key events ----- */
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+
+static int xi2_opcode;
+
+/* test if the server has XI 2.1 and select raw key events from it. As of
+ * 2.1 raw events selected on the root window are sent whether or not a
+ * grab is active, before that they stopped while a client had a grab. */
+static Bool
+check_xi2(Display * display)
+{
+    int event, error;
+    int major = 2, minor = 1;
+    unsigned char bits[XIMaskLen(XI_LASTEVENT)] = { 0 };
+    XIEventMask mask;
+
+    if (!XQueryExtension(display, "XInputExtension",
+                         &xi2_opcode, &event, &error) ||
+        XIQueryVersion(display, &major, &minor) != Success ||
+        major * 1000 + minor < 2001) {
+        if (verbose)
+            printf("No XInput 2.1, polling the keyboard\n");
+        return False;
+    }
+    if (verbose)
+        printf("X Input extension version %d.%d\n", major, minor);
+
+    XISetMask(bits, XI_RawKeyPress);
+    XISetMask(bits, XI_RawKeyRelease);
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof(bits);
+    mask.mask = bits;
+    XISelectEvents(display, DefaultRootWindow(display), &mask, 1);
+
+    return True;
+}
+
+/* Like main_loop, but sleeps in poll() until a key goes up or down or the
+ * touchpad is due to be enabled, instead of querying the keymap */
+static void
+xi2_main_loop(Display * display, double idle_time)
+{
+    unsigned char key_state[KEYMAP_SIZE] = { 0 };
+    double last_activity = 0.0;
+    double current_time;
+    struct pollfd fd;
+
+    fd.fd = ConnectionNumber(display);
+    fd.events = POLLIN;
+
+    for (;;) {
+        int timeout = -1;
+
+        while (XPending(display)) {
+            XEvent event;
+            XGenericEventCookie *cookie = &event.xcookie;
+
+            XNextEvent(display, &event);
+            if (cookie->type != GenericEvent ||
+                cookie->extension != xi2_opcode ||
+                !XGetEventData(display, cookie))
+                continue;
+
+            if (cookie->evtype == XI_RawKeyPress ||
+                cookie->evtype == XI_RawKeyRelease) {
+                XIRawEvent *raw = cookie->data;
+                int byte_num = raw->detail / 8;
+                int bit_num = raw->detail % 8;
+
+                if (byte_num < KEYMAP_SIZE) {
+                    if (cookie->evtype == XI_RawKeyPress)
+                        key_state[byte_num] |= 1 << bit_num;
+                    else
+                        key_state[byte_num] &= ~(1 << bit_num);
+                }
+
+                switch (keymap_activity(key_state)) {
+                case ActivityNew:
+                    last_activity = get_time();
+                    break;
+                case ActivityNone:
+                    break;
+                case ActivityReset:
+                    last_activity = 0.0;
+                    break;
+                }
+            }
+            XFreeEventData(display, cookie);
+        }
+
+        current_time = get_time();
+
+        /* If system times goes backwards, touchpad can get locked. Make
+         * sure our last activity wasn't in the future and reset if it was. */
+        if (last_activity > current_time)
+            last_activity = current_time - idle_time - 1;
+
+        if (current_time > last_activity + idle_time) { /* Enable touchpad */
+            toggle_touchpad(True);
+        }
+        else {                  /* Disable touchpad */
+            toggle_touchpad(False);
+            timeout = (last_activity + idle_time - current_time) * 1000 + 1;
+        }
+
+        /* reading the touchpad state may have queued events */
+        if (XPending(display))
+            continue;
+
+        poll(&fd, 1, timeout);
+    }
+}
+#endif                          /* HAVE_X11_EXTENSIONS_XINPUT2_H */
+
+/* ---- the following code is for reading the keyboards with libevdev ----- */
+#ifdef BUILD_EVENTCOMM
+
+#define DEV_INPUT_EVENT "/dev/input"
+#define EVENT_DEV_NAME "event"
+
+/* X keycodes of evdev devices are the kernel's key codes plus 8 */
+#define EVDEV_KEYCODE_OFFSET 8
+
+/* epoll data of the timer and the X connection, keyboards follow */
+#define EPOLL_TIMER 0
+#define EPOLL_DISPLAY 1
+#define EPOLL_FIRST_KEYBOARD 2
+
+#define MAX_KEYBOARDS 32
+
+static struct libevdev *keyboards[MAX_KEYBOARDS];
+
+/* A keyboard has letter keys, unlike power buttons, lid switches and
+ * touchpads, which also send EV_KEY */
+static Bool
+event_query_is_keyboard(struct libevdev *evdev)
+{
+    return libevdev_has_event_type(evdev, EV_KEY) &&
+        libevdev_has_event_code(evdev, EV_KEY, KEY_A) &&
+        libevdev_has_event_code(evdev, EV_KEY, KEY_Z) &&
+        libevdev_has_event_code(evdev, EV_KEY, KEY_SPACE);
+}
+
+/* filter for the scandir on /dev/input */
+static int
+event_dev_only(const struct dirent *dir)
+{
+    return strncmp(EVENT_DEV_NAME, dir->d_name, 5) == 0;
+}
+
+/* Open all keyboards and add them to the epoll set, returns how many */
+static int
+open_keyboards(int epfd)
+{
+    struct dirent **namelist;
+    int nkeyboards = 0;
+    int i;
+
+    i = scandir(DEV_INPUT_EVENT, &namelist, event_dev_only, alphasort);
+    if (i < 0) {
+        perror("Couldn't open " DEV_INPUT_EVENT);
+        return 0;
+    }
+
+    while (i--) {
+        char fname[64];
+        struct libevdev *evdev;
+        struct epoll_event ev;
+        int fd;
+
+        snprintf(fname, sizeof(fname), "%s/%s", DEV_INPUT_EVENT,
+                 namelist[i]->d_name);
+        free(namelist[i]);
+
+        if (nkeyboards == MAX_KEYBOARDS)
+            continue;
+
+        fd = open(fname, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        if (libevdev_new_from_fd(fd, &evdev) < 0) {
+            close(fd);
+            continue;
+        }
+        if (!event_query_is_keyboard(evdev)) {
+            libevdev_free(evdev);
+            close(fd);
+            continue;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.u32 = EPOLL_FIRST_KEYBOARD + nkeyboards;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            libevdev_free(evdev);
+            close(fd);
+            continue;
+        }
+
+        if (verbose)
+            printf("Keyboard %s: %s\n", fname, libevdev_get_name(evdev));
+        keyboards[nkeyboards++] = evdev;
+    }
+    free(namelist);
+
+    return nkeyboards;
+}
+
+/* Apply the pending events of a keyboard to key_state. Returns FALSE if
+ * the keyboard is gone. */
+static Bool
+read_keyboard(struct libevdev *evdev, unsigned char *key_state,
+              enum KeyboardActivity *activity)
+{
+    unsigned int flags = LIBEVDEV_READ_FLAG_NORMAL;
+    struct input_event ev;
+    int rc;
+
+    while ((rc = libevdev_next_event(evdev, flags, &ev)) >= 0) {
+        int keycode = ev.code + EVDEV_KEYCODE_OFFSET;
+
+        /* after a SYN_DROPPED, read the state changes libevdev made up */
+        flags = rc == LIBEVDEV_READ_STATUS_SYNC ?
+            LIBEVDEV_READ_FLAG_SYNC : LIBEVDEV_READ_FLAG_NORMAL;
+
+        /* autorepeat is no new activity */
+        if (ev.type != EV_KEY || ev.value == 2 || keycode >= 8 * KEYMAP_SIZE)
+            continue;
+
+        if (ev.value)
+            key_state[keycode / 8] |= 1 << (keycode % 8);
+        else
+            key_state[keycode / 8] &= ~(1 << (keycode % 8));
+
+        switch (keymap_activity(key_state)) {
+        case ActivityNew:
+            *activity = ActivityNew;
+            break;
+        case ActivityNone:
+            break;
+        case ActivityReset:
+            if (*activity != ActivityNew)
+                *activity = ActivityReset;
+            break;
+        }
+    }
+
+    return rc == -EAGAIN;
+}
+
+/* Rebuild key_state from the keys the open keyboards hold down, as
+ * libevdev last saw them. A key that was down on a keyboard that went away
+ * would otherwise stay down for good. */
+static void
+reset_key_state(unsigned char *key_state)
+{
+    int i, code;
+
+    memset(key_state, 0, KEYMAP_SIZE);
+    for (i = 0; i < MAX_KEYBOARDS; i++) {
+        if (!keyboards[i])
+            continue;
+        for (code = 0; code + EVDEV_KEYCODE_OFFSET < 8 * KEYMAP_SIZE; code++) {
+            int keycode = code + EVDEV_KEYCODE_OFFSET;
+
+            if (libevdev_get_event_value(keyboards[i], EV_KEY, code))
+                key_state[keycode / 8] |= 1 << (keycode % 8);
+        }
+    }
+    /* only releases keys, so no activity */
+    keymap_activity(key_state);
+}
+
+/* Like main_loop, but sleeps in epoll_wait() until a keyboard sends an
+ * event or a timer for the end of the idle time expires. Needs no round
+ * trips to the X server except to switch the touchpad. */
+static void
+evdev_main_loop(Display * display, double idle_time)
+{
+    unsigned char key_state[KEYMAP_SIZE] = { 0 };
+    struct itimerspec idle = { {0, 0}, {0, 0} };
+    struct epoll_event ev;
+    int epfd, tfd, nkeyboards;
+
+    idle.it_value.tv_sec = (time_t) idle_time;
+    idle.it_value.tv_nsec = (idle_time - idle.it_value.tv_sec) * 1e9;
+    /* an all-zero it_value would disarm the timer instead of firing it */
+    if (idle.it_value.tv_sec == 0 && idle.it_value.tv_nsec == 0)
+        idle.it_value.tv_nsec = 1;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epfd < 0 || tfd < 0) {
+        perror("syndaemon");
+        exit(5);
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = EPOLL_TIMER;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+
+    /* the X connection is only watched to notice when it goes away */
+    ev.data.u32 = EPOLL_DISPLAY;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ConnectionNumber(display), &ev);
+
+    nkeyboards = open_keyboards(epfd);
+    if (nkeyboards == 0) {
+        fprintf(stderr, "No keyboard event devices could be opened.\n");
+        exit(5);
+    }
+
+    for (;;) {
+        struct epoll_event events[MAX_KEYBOARDS + EPOLL_FIRST_KEYBOARD];
+        enum KeyboardActivity activity = ActivityNone;
+        int i, n;
+
+        n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            exit(5);
+        }
+
+        for (i = 0; i < n; i++) {
+            uint32_t id = events[i].data.u32;
+
+            if (id == EPOLL_TIMER) {
+                uint64_t expirations;
+
+                if (read(tfd, &expirations, sizeof(expirations)) > 0)
+                    toggle_touchpad(True);
+            }
+            else if (id == EPOLL_DISPLAY) {
+                /* fails and exits if the server is gone */
+                while (XPending(display)) {
+                    XEvent event;
+
+                    XNextEvent(display, &event);
+                }
+            }
+            else {
+                struct libevdev *evdev = keyboards[id - EPOLL_FIRST_KEYBOARD];
+
+                if (!read_keyboard(evdev, key_state, &activity)) {
+                    int fd = libevdev_get_fd(evdev);
+
+                    if (verbose)
+                        printf("Keyboard %s is gone\n",
+                               libevdev_get_name(evdev));
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                    libevdev_free(evdev);
+                    close(fd);
+                    keyboards[id - EPOLL_FIRST_KEYBOARD] = NULL;
+                    reset_key_state(key_state);
+                }
+            }
+        }
+
+        if (activity == ActivityNew) {
+            toggle_touchpad(False);
+            timerfd_settime(tfd, 0, &idle, NULL);
+        }
+        else if (activity == ActivityReset) {
+            struct itimerspec off = { {0, 0}, {0, 0} };
+
+            timerfd_settime(tfd, 0, &off, NULL);
+            toggle_touchpad(True);
+        }
+    }
+}
+#endif                          /* BUILD_EVENTCOMM */
+
 /* ---- the following code is for using the xrecord extension ----- */
 #ifdef HAVE_X11_EXTENSIONS_RECORD_H
 
@@ -569,9 +977,10 @@ main(int argc, char *argv[])
     int poll_delay = 200000;    /* 200 ms */
     int c;
     int use_xrecord = 0;
+    int use_evdev = 0;
 
     /* Parse command line parameters */
-    while ((c = getopt(argc, argv, "i:m:dtp:kKR?v")) != EOF) {
+    while ((c = getopt(argc, argv, "i:m:dtp:kKRE?v")) != EOF) {
         switch (c) {
         case 'i':
             idle_time = atof(optarg);
@@ -598,6 +1007,11 @@ main(int argc, char *argv[])
         case 'R':
             use_xrecord = 1;
             break;
+#ifdef BUILD_EVENTCOMM
+        case 'E':
+            use_evdev = 1;
+            break;
+#endif
         case 'v':
             verbose = 1;
             break;
@@ -609,6 +1023,10 @@ main(int argc, char *argv[])
     }
     if (idle_time <= 0.0)
         usage();
+    if (use_evdev && use_xrecord) {
+        fprintf(stderr, "-E and -R can't be used together.\n");
+        usage();
+    }
 
     /* Open a connection to the X server */
     display = XOpenDisplay(NULL);
@@ -668,7 +1086,17 @@ main(int argc, char *argv[])
         setup_keyboard_mask(display, ignore_modifier_keys);
 
         /* Run the main loop */
-        main_loop(display, idle_time, poll_delay);
+#ifdef BUILD_EVENTCOMM
+        if (use_evdev)
+            evdev_main_loop(display, idle_time);
+        else
+#endif                          /* BUILD_EVENTCOMM */
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+        if (check_xi2(display))
+            xi2_main_loop(display, idle_time);
+        else
+#endif                          /* HAVE_X11_EXTENSIONS_XINPUT2_H */
+            main_loop(display, idle_time, poll_delay);
     }
     return 0;
 }